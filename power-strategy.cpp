@@ -4,10 +4,17 @@
  * Strategy:
  * - Deep sleep between readings (4 min 50 sec)
  * - Wake up every 5 minutes
- * - Take ultrasonic reading
+ * - Take ultrasonic readings (all sensors in SENSORS[], group by group)
  * - Connect WiFi quickly
  * - Send to Firebase
  * - Disconnect and return to deep sleep
+ * - Keep wall clock in RTC memory, re-sync via SNTP every 6 hours
+ * - Measure battery each wake and back off (longer sleep, batched
+ *   uploads) as state of charge drops
+ * - Pull per-device config from Firebase only when its version changes
+ * 
+ * Build with FAST_WAKE 1 for production: no serial output, no LED
+ * blinks and no cosmetic delays between reset and sleep.
  * 
  * Target: 24+ hours on 500mAh battery
  * Expected: ~3.5 days actual runtime
@@ -19,11 +26,55 @@
 #include <WiFi.h>
 #include <WiFiClientSecure.h>
 #include <FirebaseClient.h>
+#include <esp_sntp.h>
+#include <esp_rtc_time.h>
+#include <Preferences.h>
+#include <sys/time.h>
+
+// Production fast-wake profile: strips serial logging and non-essential delays
+#define FAST_WAKE 0
+
+#if FAST_WAKE
+// if (0) keeps arguments type-checked and "used" while generating no code
+#define LOG_PRINT(...) do { if (0) Serial.print(__VA_ARGS__); } while (0)
+#define LOG_PRINTLN(...) do { if (0) Serial.println(__VA_ARGS__); } while (0)
+#define LOG_PRINTF(...) do { if (0) Serial.printf(__VA_ARGS__); } while (0)
+#else
+#define LOG_PRINT(...) Serial.print(__VA_ARGS__)
+#define LOG_PRINTLN(...) Serial.println(__VA_ARGS__)
+#define LOG_PRINTF(...) Serial.printf(__VA_ARGS__)
+#endif
 
 // Pin definitions
 #define TRIG_PIN 2
 #define ECHO_PIN 3
 #define LED_PIN 21  // Built-in LED for status indication
+#define BATTERY_PIN 4 // ADC1_CH4, battery through a 2:1 divider (halves the voltage)
+
+// Ultrasonic sensors: one trigger/echo pair per channel
+struct SensorChannel {
+    uint8_t trigPin;
+    uint8_t echoPin;
+    uint8_t group;    // Channels sharing a group fire together
+};
+
+// Only put sensors in the same group if they cannot hear each other's bursts
+const SensorChannel SENSORS[] = {
+    { TRIG_PIN, ECHO_PIN, 0 },
+    // { 5, 6, 1 },  // Add further channels here
+};
+const int SENSOR_COUNT = sizeof(SENSORS) / sizeof(SENSORS[0]);
+
+const float MAX_RANGE_CM = 400.0;
+const unsigned long MAX_ECHO_US = MAX_RANGE_CM * 2 / 0.0343; // ~23.3 ms round trip at max range
+const unsigned long ECHO_START_US = 1000; // Trigger to echo rise (40 kHz burst), with margin
+
+// Groups fire one after another, so no sensor is listening while another group's burst
+// goes out. A group ends as soon as all of its channels have echoed, or after
+// ECHO_START_US + MAX_ECHO_US; anything still pending then is out of range. Separate groups
+// cost about what back-to-back pulseIn() calls would for in-range targets, but a missing
+// echo is cut off at ~24 ms instead of the sensor's ~38 ms timeout. Awake time grows with
+// the number of groups, not channels.
 
 // WiFi credentials
 const char* ssid     = "UW MPSK";
@@ -46,116 +97,314 @@ RealtimeDatabase Database;
 const unsigned long SLEEP_DURATION = 290 * 1000000ULL; // 4 min 50 sec in microseconds (290 seconds)
 const unsigned long AWAKE_TIMEOUT = 10000; // 10 seconds max awake time
 const int MAX_WIFI_ATTEMPTS = 20; // Limit WiFi connection attempts
+const unsigned long WIFI_ATTEMPT_MS = 500; // One connection "attempt" = this much waiting
+const unsigned long POLL_MS = FAST_WAKE ? 10 : 100; // Status polling granularity while waiting
+
+// Timekeeping configuration
+const char* NTP_SERVER = "pool.ntp.org";
+const int64_t SNTP_RESYNC_INTERVAL = 6 * 3600 * 1000LL; // Re-sync wall clock every 6 hours (ms)
+const unsigned long SNTP_TIMEOUT = 2000; // Max wait for an SNTP reply (ms)
+const int SNTP_MAX_BACKOFF = 16; // Most upload cycles skipped between failed sync attempts
+const float MAX_DRIFT_PPM = 50000; // Clamp learned RTC drift to 5% of whatever was slept
+
+// Battery measurement
+const float BATTERY_DIVIDER = 2.0; // Battery voltage / ADC pin voltage
+const int BATTERY_SAMPLES = 16;    // ADC readings averaged per wake
+
+// LiPo discharge curve (mV -> % state of charge), highest voltage first
+struct CurvePoint {
+    int millivolts;
+    int percent;
+};
+
+const CurvePoint DISCHARGE_CURVE[] = {
+    { 4200, 100 }, { 4100, 90 }, { 4000, 78 }, { 3900, 65 }, { 3800, 50 },
+    { 3700, 35 }, { 3600, 20 }, { 3500, 10 }, { 3400, 5 }, { 3300, 0 }
+};
+const int CURVE_POINTS = sizeof(DISCHARGE_CURVE) / sizeof(DISCHARGE_CURVE[0]);
+
+// Operating profiles, richest first; a profile is used while SoC >= minSoc
+struct PowerProfile {
+    const char* name;
+    int minSoc;              // % state of charge
+    unsigned long sleepSeconds;
+    int readingsPerUpload;   // Readings buffered in RTC memory per WiFi connection
+    bool sendTimestamp;
+};
+
+const PowerProfile PROFILES[] = {
+    { "FULL",     50, SLEEP_DURATION / 1000000, 1, true },
+    { "ECO",      25,  590, 3, true },
+    { "SURVIVAL", 10, 1790, 6, false },
+    { "CRITICAL",  0, 3590, 12, false }
+};
+const int PROFILE_COUNT = sizeof(PROFILES) / sizeof(PROFILES[0]);
+const int SOC_HYSTERESIS = 5; // % above a threshold before stepping back up
+
+// Readings waiting for the next upload
+struct PendingReading {
+    float distances[SENSOR_COUNT];
+    int boot;
+    int64_t epochMs;        // 0 if the clock was not set when sampled
+    unsigned long uptimeMs; // millis() when sampled
+    int batteryMv;
+};
+
+const int MAX_PENDING = 12;
+
+// Remote configuration at /config/<MAC without colons>, cached in NVS
+struct DeviceConfig {
+    int version;
+    unsigned long sleepSeconds; // FULL profile sleep; the other profiles scale with it
+    int maxWifiAttempts;
+};
 
 // Persistent data (survives deep sleep)
 RTC_DATA_ATTR int bootCount = 0;
 RTC_DATA_ATTR int successfulReadings = 0;
 RTC_DATA_ATTR int failedReadings = 0;
+RTC_DATA_ATTR int profileIndex = 0;
+RTC_DATA_ATTR unsigned long lastSleepSeconds = 0;
+RTC_DATA_ATTR PendingReading pendingReadings[MAX_PENDING];
+RTC_DATA_ATTR int pendingCount = 0;
+RTC_DATA_ATTR DeviceConfig config = { 0, SLEEP_DURATION / 1000000, MAX_WIFI_ATTEMPTS };
+
+// Wake latency and budget result of the previous cycle, uploaded with the next batch
+RTC_DATA_ATTR unsigned long lastAckToSleepMs = 0;
+RTC_DATA_ATTR unsigned long lastSkippedDelayMs = 0;
+RTC_DATA_ATTR bool lastOverBudget = false;
+
+// Wall clock kept across deep sleep, synced by SNTP only every few hours
+RTC_DATA_ATTR bool timeValid = false;
+RTC_DATA_ATTR int64_t epochAtSleepMs = 0;   // Wall clock when deep sleep was entered
+RTC_DATA_ATTR int64_t lastSyncEpochMs = 0;  // Wall clock at the last SNTP sync
+RTC_DATA_ATTR uint64_t rtcAtSleepUs = 0;    // RTC timer when deep sleep was entered
+RTC_DATA_ATTR float driftPpm = 0;           // Learned RTC clock error, scales with time slept
+RTC_DATA_ATTR int64_t rtcSinceSyncMs = 0;   // Sleep + wake-up time (RTC clock) since the last sync
+RTC_DATA_ATTR int sleepsSinceSync = 0;
+RTC_DATA_ATTR int sntpBackoff = 0;    // Upload cycles to skip after the last failed sync (doubles per failure)
+RTC_DATA_ATTR int sntpSkipCycles = 0; // Cycles still to skip before the next attempt
+
+// Wall clock corresponding to millis() == 0 for this boot
+int64_t epochAtBootMs = 0;
+
+// Cycle trace: compact 8-byte records, dumped over Serial as hex when TRACE_DUMP is set
+// or the cycle exceeds its budget; trace-replay/ re-runs the dumped scenarios on the host
+#ifndef TRACE_DUMP
+#define TRACE_DUMP 0
+#endif
+
+enum TraceType : uint8_t {
+    TRACE_STAGE = 1,       // tag = stage entered
+    TRACE_ECHO = 2,        // tag = sensor channel, value = echo pulse width (us), 0 = timeout
+    TRACE_WIFI = 3,        // tag = wl_status_t, value = connect time (ms) once connected
+    TRACE_FB_REQUEST = 4,  // tag = request slot (1 upload, 2 config version, 3 config fetch)
+    TRACE_FB_RESPONSE = 5, // tag = 1 ok / 0 error, value = latency (ms)
+    TRACE_END = 6
+};
+
+struct TraceEvent {
+    uint32_t timeMs;
+    uint8_t type;
+    uint8_t tag;
+    uint16_t value;
+};
+
+enum CycleStage : uint8_t {
+    STAGE_BOOT = 0,
+    STAGE_SENSOR = 1,
+    STAGE_WIFI = 2,
+    STAGE_FIREBASE = 3,
+    STAGE_SLEEP = 4
+};
+
+const int TRACE_CAPACITY = 64;
+const float STAGE_MA[] = { 20.0, 30.0, 120.0, 180.0, 20.0 }; // Same model as the cycle estimate
+
+// Per-cycle budget; modelled baseline plus ~15% headroom
+const unsigned long BUDGET_AWAKE_MS = AWAKE_TIMEOUT;
+const int BUDGET_REQUESTS = 2; // Upload + config version read; +1 on cycles that fetch a new config
+const unsigned long BUDGET_MICRO_AH = FAST_WAKE ? 250 : 310; // wakeDelay()s and LED blinks cost ~60 uAh
+
+TraceEvent traceBuffer[TRACE_CAPACITY];
+int traceCount = 0;
+int pendingRequests = 0;
+unsigned long requestStart[4];
+bool uploadConfirmed = false;
+
+// Wake latency for this cycle (esp_timer starts at app start, so ROM/bootloader time is not included)
+int64_t bootToReadingUs = 0;
+int64_t ackUs = 0;
+unsigned long skippedDelayMs = 0; // Delays the standard build would have spent
 
 // Function declarations
-float readUltrasonic();
+void readUltrasonics(float *distances);
 bool connectWiFi();
-bool sendToFirebase(float distance);
+bool sendToFirebase();
 void enterDeepSleep();
 void blinkLED(int times);
+void wakeDelay(unsigned long ms);
+void restoreClock(bool timerWake);
+bool syncClockIfDue();
+int64_t nowEpochMs();
+void traceEvent(uint8_t type, uint8_t tag, uint16_t value);
+void processData(AsyncResult &aResult);
+bool checkCycleBudget();
+void dumpTrace();
+int readBatteryVoltage();
+int socFromVoltage(int millivolts);
+void selectProfile(int soc);
+void queueReading(const float *distances, unsigned long readingMillis, int batteryMv);
+void traceResponse(bool ok);
+void loadConfig();
+bool checkRemoteConfig();
+bool jsonNumber(const String &json, const char *key, double &value);
+unsigned long profileSleepSeconds(const PowerProfile &profile);
+String deviceId();
 
 void setup()
 {
+    traceEvent(TRACE_STAGE, STAGE_BOOT, 0);
+    
+#if !FAST_WAKE
     Serial.begin(115200);
-    delay(500);
+#endif
+    wakeDelay(500);
     
-    pinMode(TRIG_PIN, OUTPUT);
-    pinMode(ECHO_PIN, INPUT);
+    for (int i = 0; i < SENSOR_COUNT; i++) {
+        pinMode(SENSORS[i].trigPin, OUTPUT);
+        pinMode(SENSORS[i].echoPin, INPUT);
+        digitalWrite(SENSORS[i].trigPin, LOW);
+    }
     pinMode(LED_PIN, OUTPUT);
-    digitalWrite(TRIG_PIN, LOW);
     digitalWrite(LED_PIN, LOW);
     
     bootCount++;
     
-    Serial.println("\n========================================");
-    Serial.println("  POWER-SAVING STRATEGY: SMART INTERVAL");
-    Serial.println("========================================");
-    Serial.printf("Boot #%d\n", bootCount);
-    Serial.printf("Success: %d | Failed: %d\n", successfulReadings, failedReadings);
+    LOG_PRINTLN("\n========================================");
+    LOG_PRINTLN("  POWER-SAVING STRATEGY: SMART INTERVAL");
+    LOG_PRINTLN("========================================");
+    LOG_PRINTF("Boot #%d\n", bootCount);
+    LOG_PRINTF("Success: %d | Failed: %d\n", successfulReadings, failedReadings);
     
     // Check wake reason
     esp_sleep_wakeup_cause_t wakeup_reason = esp_sleep_get_wakeup_cause();
     if (wakeup_reason == ESP_SLEEP_WAKEUP_TIMER) {
-        Serial.println("Woke from deep sleep (timer)");
+        LOG_PRINTLN("Woke from deep sleep (timer)");
     } else {
-        Serial.println("Fresh boot or reset");
+        LOG_PRINTLN("Fresh boot or reset");
+    }
+    restoreClock(wakeup_reason == ESP_SLEEP_WAKEUP_TIMER);
+    if (wakeup_reason != ESP_SLEEP_WAKEUP_TIMER) {
+        // RTC memory is garbage after a reset: drop the buffer, reload the config from NVS
+        pendingCount = 0;
+        profileIndex = 0;
+        loadConfig();
     }
     
-    Serial.println("\n--- STAGE 1: SENSOR READING ---");
+    LOG_PRINTLN("\n--- STAGE 1: SENSOR READING ---");
+    traceEvent(TRACE_STAGE, STAGE_SENSOR, 0);
     unsigned long stage1Start = millis();
     
-    // Take sensor reading
-    float distance = readUltrasonic();
-    if (distance < 0) {
-        Serial.println("⚠️  Sensor read failed, using default");
-        distance = 100.0;
-    } else {
-        Serial.printf("✓ Distance: %.2f cm\n", distance);
+    // Take sensor readings (all channels in one overlapped window)
+    float distances[SENSOR_COUNT];
+    readUltrasonics(distances);
+    unsigned long readingMillis = millis();
+    bootToReadingUs = esp_timer_get_time();
+    for (int i = 0; i < SENSOR_COUNT; i++) {
+        if (distances[i] < 0) {
+            LOG_PRINTF("⚠️  Sensor %d read failed, using default\n", i);
+            distances[i] = 100.0;
+        } else {
+            LOG_PRINTF("✓ Distance[%d]: %.2f cm\n", i, distances[i]);
+        }
     }
+    
+    // Battery is sampled before the radio comes up, while we're awake anyway
+    int batteryMv = readBatteryVoltage();
+    int soc = socFromVoltage(batteryMv);
+    selectProfile(soc);
+    const PowerProfile &profile = PROFILES[profileIndex];
+    LOG_PRINTF("🔋 Battery: %d mV (%d%%) → profile %s\n", batteryMv, soc, profile.name);
+    
+    queueReading(distances, readingMillis, batteryMv);
     blinkLED(1);
     
     unsigned long stage1Time = millis() - stage1Start;
-    Serial.printf("Stage 1 time: %lu ms\n", stage1Time);
+    LOG_PRINTF("Stage 1 time: %lu ms\n", stage1Time);
+    
+    if (pendingCount < profile.readingsPerUpload) {
+        LOG_PRINTF("Buffered %d/%d readings, skipping upload\n", 
+                      pendingCount, profile.readingsPerUpload);
+        enterDeepSleep();
+        return;
+    }
     
     // Connect WiFi
-    Serial.println("\n--- STAGE 2: WiFi CONNECTION ---");
+    LOG_PRINTLN("\n--- STAGE 2: WiFi CONNECTION ---");
+    traceEvent(TRACE_STAGE, STAGE_WIFI, 0);
     unsigned long stage2Start = millis();
     
     bool wifiConnected = connectWiFi();
     
     unsigned long stage2Time = millis() - stage2Start;
-    Serial.printf("Stage 2 time: %lu ms\n", stage2Time);
+    LOG_PRINTF("Stage 2 time: %lu ms\n", stage2Time);
     
     if (!wifiConnected) {
-        Serial.println("✗ WiFi failed, skipping Firebase");
+        LOG_PRINTLN("✗ WiFi failed, skipping Firebase");
         failedReadings++;
         blinkLED(3); // 3 blinks = error
-        delay(100);
+        wakeDelay(100);
         enterDeepSleep();
         return;
     }
     
     blinkLED(2); // 2 blinks = WiFi connected
     
+    // Piggy-back an occasional SNTP sync on the connection we already have
+    syncClockIfDue();
+    
     // Send to Firebase
-    Serial.println("\n--- STAGE 3: FIREBASE SEND ---");
+    LOG_PRINTLN("\n--- STAGE 3: FIREBASE SEND ---");
+    traceEvent(TRACE_STAGE, STAGE_FIREBASE, 0);
     unsigned long stage3Start = millis();
     
-    bool sentSuccessfully = sendToFirebase(distance);
+    int uploadCount = pendingCount;
+    bool sentSuccessfully = sendToFirebase();
     
     unsigned long stage3Time = millis() - stage3Start;
-    Serial.printf("Stage 3 time: %lu ms\n", stage3Time);
+    LOG_PRINTF("Stage 3 time: %lu ms\n", stage3Time);
     
     if (sentSuccessfully) {
-        successfulReadings++;
-        Serial.println("✓ Data sent successfully");
+        successfulReadings += uploadCount;
+        LOG_PRINTLN("✓ Data sent successfully");
         blinkLED(4); // 4 blinks = success
     } else {
         failedReadings++;
-        Serial.println("✗ Firebase send failed");
+        LOG_PRINTLN("✗ Firebase send failed");
         blinkLED(3); // 3 blinks = error
     }
     
     // Disconnect WiFi to save power
-    Serial.println("\n--- STAGE 4: DISCONNECT & SLEEP ---");
+    LOG_PRINTLN("\n--- STAGE 4: DISCONNECT & SLEEP ---");
+    traceEvent(TRACE_STAGE, STAGE_SLEEP, 0);
     WiFi.disconnect(true);
     WiFi.mode(WIFI_OFF);
-    Serial.println("✓ WiFi disconnected");
+    traceEvent(TRACE_WIFI, WiFi.status(), 0);
+    LOG_PRINTLN("✓ WiFi disconnected");
     
+#if !FAST_WAKE
     // Summary
     unsigned long totalAwakeTime = millis();
-    Serial.println("\n========================================");
-    Serial.println("CYCLE SUMMARY:");
-    Serial.printf("  Sensor reading:  %lu ms\n", stage1Time);
-    Serial.printf("  WiFi connect:    %lu ms\n", stage2Time);
-    Serial.printf("  Firebase send:   %lu ms\n", stage3Time);
-    Serial.printf("  Total awake:     %lu ms\n", totalAwakeTime);
-    Serial.println("========================================");
+    LOG_PRINTLN("\n========================================");
+    LOG_PRINTLN("CYCLE SUMMARY:");
+    LOG_PRINTF("  Sensor reading:  %lu ms\n", stage1Time);
+    LOG_PRINTF("  WiFi connect:    %lu ms\n", stage2Time);
+    LOG_PRINTF("  Firebase send:   %lu ms\n", stage3Time);
+    LOG_PRINTF("  Total awake:     %lu ms\n", totalAwakeTime);
+    LOG_PRINTF("  Boot → reading:  %lu ms\n", (unsigned long)(bootToReadingUs / 1000));
+    LOG_PRINTF("  Prev ack → sleep: %lu ms (%lu ms skipped)\n", lastAckToSleepMs, lastSkippedDelayMs);
+    LOG_PRINTLN("========================================");
     
     // Power consumption estimate
     float sensorPower = (stage1Time / 1000.0) * 30.0; // 30mA for sensor
@@ -163,27 +412,28 @@ void setup()
     float firebasePower = (stage3Time / 1000.0) * 180.0; // 180mA for Firebase
     float totalPower = sensorPower + wifiPower + firebasePower;
     
-    Serial.println("\nPOWER CONSUMPTION ESTIMATE:");
-    Serial.printf("  Sensor:   %.3f mAh\n", sensorPower / 3600.0);
-    Serial.printf("  WiFi:     %.3f mAh\n", wifiPower / 3600.0);
-    Serial.printf("  Firebase: %.3f mAh\n", firebasePower / 3600.0);
-    Serial.printf("  Total:    %.3f mAh\n", totalPower / 3600.0);
+    LOG_PRINTLN("\nPOWER CONSUMPTION ESTIMATE:");
+    LOG_PRINTF("  Sensor:   %.3f mAh\n", sensorPower / 3600.0);
+    LOG_PRINTF("  WiFi:     %.3f mAh\n", wifiPower / 3600.0);
+    LOG_PRINTF("  Firebase: %.3f mAh\n", firebasePower / 3600.0);
+    LOG_PRINTF("  Total:    %.3f mAh\n", totalPower / 3600.0);
     
-    // Calculate projected battery life
-    float cyclesPerHour = 12.0; // Every 5 minutes
+    // Calculate projected battery life (one upload per readingsPerUpload wakes)
+    float cyclesPerHour = 3600.0 / profileSleepSeconds(profile) / profile.readingsPerUpload;
     float mAhPerHour = (totalPower / 3600.0) * cyclesPerHour;
     float hoursOn500mAh = 500.0 / mAhPerHour;
     
-    Serial.println("\nBATTERY LIFE PROJECTION:");
-    Serial.printf("  mAh per cycle:  %.3f\n", totalPower / 3600.0);
-    Serial.printf("  Cycles/hour:    %.1f\n", cyclesPerHour);
-    Serial.printf("  mAh/hour:       %.2f\n", mAhPerHour);
-    Serial.printf("  Battery life:   %.1f hours (%.1f days)\n", 
+    LOG_PRINTLN("\nBATTERY LIFE PROJECTION:");
+    LOG_PRINTF("  mAh per cycle:  %.3f\n", totalPower / 3600.0);
+    LOG_PRINTF("  Cycles/hour:    %.1f\n", cyclesPerHour);
+    LOG_PRINTF("  mAh/hour:       %.2f\n", mAhPerHour);
+    LOG_PRINTF("  Battery life:   %.1f hours (%.1f days)\n", 
                   hoursOn500mAh, hoursOn500mAh / 24.0);
-    Serial.println("========================================\n");
+    LOG_PRINTLN("========================================\n");
+#endif
     
     // Enter deep sleep
-    delay(500);
+    wakeDelay(500);
     enterDeepSleep();
 }
 
@@ -192,60 +442,122 @@ void loop()
     // Never reached - we go directly to deep sleep from setup()
 }
 
-float readUltrasonic()
+// Echo edge timestamps, filled in by the per-channel interrupt
+struct EchoCapture {
+    uint8_t echoPin;
+    volatile unsigned long riseUs;
+    volatile unsigned long fallUs;
+    volatile bool done;
+};
+
+EchoCapture echoCaptures[SENSOR_COUNT];
+
+void IRAM_ATTR onEchoEdge(void *arg)
+{
+    EchoCapture *capture = (EchoCapture *)arg;
+    unsigned long now = micros();
+    if (digitalRead(capture->echoPin)) {
+        capture->riseUs = now;
+    } else if (capture->riseUs != 0 && !capture->done) {
+        capture->fallUs = now;
+        capture->done = true;
+    }
+}
+
+void readUltrasonics(float *distances)
 {
-    digitalWrite(TRIG_PIN, LOW);
-    delayMicroseconds(5);
-    digitalWrite(TRIG_PIN, HIGH);
-    delayMicroseconds(10);
-    digitalWrite(TRIG_PIN, LOW);
-    
-    long duration = pulseIn(ECHO_PIN, HIGH, 50000);
-    if (duration == 0) return -1;
-    
-    float distance = (float)duration * 0.0343 / 2.0;
-    if (distance < 2.0 || distance > 400.0) return -1;
+    // Interrupts time the echoes, so each group moves on at its last echo rather than
+    // waiting out a fixed slot per channel
+    int groupCount = 0;
+    for (int i = 0; i < SENSOR_COUNT; i++) groupCount = max(groupCount, SENSORS[i].group + 1);
+    
+    for (int group = 0; group < groupCount; group++) {
+        for (int i = 0; i < SENSOR_COUNT; i++) {
+            if (SENSORS[i].group != group) continue;
+            EchoCapture &capture = echoCaptures[i];
+            capture.echoPin = SENSORS[i].echoPin;
+            capture.riseUs = 0;
+            capture.fallUs = 0;
+            capture.done = false;
+            attachInterruptArg(digitalPinToInterrupt(capture.echoPin), onEchoEdge, &capture, CHANGE);
+        }
+        
+        unsigned long start = micros();
+        for (int i = 0; i < SENSOR_COUNT; i++) {
+            if (SENSORS[i].group == group) digitalWrite(SENSORS[i].trigPin, HIGH);
+        }
+        delayMicroseconds(10);
+        for (int i = 0; i < SENSOR_COUNT; i++) {
+            if (SENSORS[i].group == group) digitalWrite(SENSORS[i].trigPin, LOW);
+        }
+        
+        bool allDone = false;
+        while (!allDone && micros() - start < ECHO_START_US + MAX_ECHO_US) {
+            allDone = true;
+            for (int i = 0; i < SENSOR_COUNT; i++) {
+                if (SENSORS[i].group == group) allDone = allDone && echoCaptures[i].done;
+            }
+        }
+        
+        // Stop listening before the next group fires; a late edge would be its burst
+        for (int i = 0; i < SENSOR_COUNT; i++) {
+            if (SENSORS[i].group == group) detachInterrupt(digitalPinToInterrupt(SENSORS[i].echoPin));
+        }
+    }
     
-    return distance;
+    for (int i = 0; i < SENSOR_COUNT; i++) {
+        EchoCapture &capture = echoCaptures[i];
+        unsigned long duration = capture.done ? capture.fallUs - capture.riseUs : 0;
+        traceEvent(TRACE_ECHO, i, min(duration, 65535UL));
+        
+        distances[i] = -1;
+        if (duration == 0) continue;
+        
+        float distance = (float)duration * 0.0343 / 2.0;
+        if (distance >= 2.0 && distance <= MAX_RANGE_CM) distances[i] = distance;
+    }
 }
 
 bool connectWiFi()
 {
-    Serial.printf("Connecting to %s...\n", ssid);
+    LOG_PRINTF("Connecting to %s...\n", ssid);
     
     WiFi.mode(WIFI_STA);
     WiFi.setSleep(false); // Disable sleep for faster connection
     WiFi.begin(ssid, password);
 
-    int attempts = 0;
-    Serial.print("  ");
-    while (WiFi.status() != WL_CONNECTED && attempts < MAX_WIFI_ATTEMPTS) {
-        delay(500);
-        Serial.print(".");
-        attempts++;
+    // Same timeout as before, but polled finely so we don't sit out the rest of a 500 ms slot
+    unsigned long connectStart = millis();
+    unsigned long timeout = config.maxWifiAttempts * WIFI_ATTEMPT_MS;
+    LOG_PRINT("  ");
+    while (WiFi.status() != WL_CONNECTED && (millis() - connectStart) < timeout) {
+        delay(POLL_MS);
+        if ((millis() - connectStart) % WIFI_ATTEMPT_MS < POLL_MS) LOG_PRINT(".");
     }
     
-    Serial.println();
+    LOG_PRINTLN();
+    bool connected = WiFi.status() == WL_CONNECTED;
+    traceEvent(TRACE_WIFI, WiFi.status(), connected ? min(millis() - connectStart, 65535UL) : 0);
     
-    if (WiFi.status() == WL_CONNECTED) {
-        Serial.printf("✓ Connected! IP: %s\n", WiFi.localIP().toString().c_str());
-        Serial.printf("  Signal: %d dBm\n", WiFi.RSSI());
+    if (connected) {
+        LOG_PRINTF("✓ Connected! IP: %s\n", WiFi.localIP().toString().c_str());
+        LOG_PRINTF("  Signal: %d dBm\n", WiFi.RSSI());
         return true;
     } else {
-        Serial.printf("✗ Failed after %d attempts\n", attempts);
+        LOG_PRINTF("✗ Failed after %lu attempts\n", (millis() - connectStart) / WIFI_ATTEMPT_MS);
         return false;
     }
 }
 
-bool sendToFirebase(float distance)
+bool sendToFirebase()
 {
-    Serial.println("Initializing Firebase...");
+    LOG_PRINTLN("Initializing Firebase...");
     
     ssl_client.setInsecure();
     ssl_client.setHandshakeTimeout(8);
     
     // Initialize Firebase (blocking with timeout)
-    initializeApp(async_client, app, getAuth(user_auth), nullptr, "authTask");
+    initializeApp(async_client, app, getAuth(user_auth), processData, "authTask");
     app.getApp<RealtimeDatabase>(Database);
     Database.url("https://esp-project-7e4c3-default-rtdb.firebaseio.com/");
     
@@ -253,59 +565,448 @@ bool sendToFirebase(float distance)
     unsigned long authStart = millis();
     while (!app.ready() && (millis() - authStart) < 8000) {
         app.loop();
-        delay(100);
+        delay(POLL_MS);
     }
     
     if (!app.ready()) {
-        Serial.println("✗ Firebase auth timeout");
+        LOG_PRINTLN("✗ Firebase auth timeout");
         return false;
     }
     
-    Serial.println("✓ Firebase authenticated");
+    LOG_PRINTLN("✓ Firebase authenticated");
+    
+    // All buffered readings go up in one multi-path update
+    bool sendTimestamp = PROFILES[profileIndex].sendTimestamp;
+    String json = "{";
+    char entry[160];
+    for (int i = 0; i < pendingCount; i++) {
+        const PendingReading &reading = pendingReadings[i];
+        
+        // Wall-clock ms when known; otherwise only ms since boot, under its own key
+        int64_t timestamp = reading.epochMs;
+        if (timestamp == 0 && reading.boot == bootCount && timeValid) {
+            timestamp = epochAtBootMs + reading.uptimeMs;
+        }
+        
+        snprintf(entry, sizeof(entry), "%s\"reading_%d\":{\"boot\":%d,\"battery_mv\":%d",
+                 i > 0 ? "," : "", reading.boot, reading.boot, reading.batteryMv);
+        json += entry;
+        
+        // Channel 0 keeps the original "distance" key
+        for (int c = 0; c < SENSOR_COUNT; c++) {
+            if (c == 0) {
+                snprintf(entry, sizeof(entry), ",\"distance\":%.2f", reading.distances[c]);
+            } else {
+                snprintf(entry, sizeof(entry), ",\"distance_%d\":%.2f", c, reading.distances[c]);
+            }
+            json += entry;
+        }
+        
+        if (sendTimestamp && timestamp != 0) {
+            snprintf(entry, sizeof(entry), ",\"timestamp\":%lld", (long long)timestamp);
+            json += entry;
+        } else if (sendTimestamp) {
+            snprintf(entry, sizeof(entry), ",\"uptime_ms\":%lu", reading.uptimeMs);
+            json += entry;
+        }
+        json += "}";
+    }
     
-    // Send data
-    String path = "/power_saving/reading_" + String(bootCount);
+    // Wake latency rides along in the same update
+    snprintf(entry, sizeof(entry), 
+        ",\"wake_profile/boot_%d\":{\"boot_to_reading_ms\":%lu,\"prev_ack_to_sleep_ms\":%lu,\"prev_skipped_ms\":%lu,"
+        "\"prev_over_budget\":%s}",
+        bootCount, (unsigned long)(bootToReadingUs / 1000), lastAckToSleepMs, lastSkippedDelayMs, 
+        lastOverBudget ? "true" : "false");
+    json += entry;
+    json += "}";
     
-    Serial.printf("Sending to: %s\n", path.c_str());
+    LOG_PRINTF("Sending %d reading(s) to /power_saving\n", pendingCount);
     
-    // Use blocking call for simplicity in deep sleep scenario
-    bool success = true;
+    uploadConfirmed = false;
+    traceEvent(TRACE_FB_REQUEST, 1, pendingCount);
+    Database.update<object_t>(async_client, "/power_saving", object_t(json), processData, "Send");
     
-    Database.set<float>(async_client, path + "/distance", distance, nullptr, "Send1");
-    app.loop();
-    delay(100);
+    // Wait for the ack so the buffer is only cleared once the data is stored
+    unsigned long sendStart = millis();
+    while (pendingRequests > 0 && (millis() - sendStart) < 3000) {
+        app.loop();
+        delay(10);
+    }
     
-    Database.set<int>(async_client, path + "/boot", bootCount, nullptr, "Send2");
-    app.loop();
-    delay(100);
+    if (!uploadConfirmed) {
+        LOG_PRINTF("✗ No ack, keeping %d reading(s) buffered\n", pendingCount);
+        return false;
+    }
     
-    Database.set<unsigned long>(async_client, path + "/timestamp", millis(), nullptr, "Send3");
-    app.loop();
-    delay(100);
+    pendingCount = 0;
+    LOG_PRINTLN("✓ Data sent to Firebase");
     
-    Serial.println("✓ Data sent to Firebase");
-    return success;
+    // Same connection: one small version read, full config only when it changed
+    checkRemoteConfig();
+    return true;
 }
 
 void enterDeepSleep()
 {
-    Serial.println("\n💤 Entering deep sleep for 4 min 50 sec...");
-    Serial.println("========================================\n");
-    delay(100);
+    traceEvent(TRACE_END, 0, 0);
+    lastOverBudget = !checkCycleBudget();
+    if (TRACE_DUMP || lastOverBudget) dumpTrace();
+    
+    lastSleepSeconds = profileSleepSeconds(PROFILES[profileIndex]);
+    
+    LOG_PRINTF("\n💤 Entering deep sleep for %lu min %lu sec (%s)...\n", 
+                  lastSleepSeconds / 60, lastSleepSeconds % 60, PROFILES[profileIndex].name);
+    LOG_PRINTLN("========================================\n");
+    wakeDelay(100);
     
     // Configure timer wake up
-    esp_sleep_enable_timer_wakeup(SLEEP_DURATION);
+    esp_sleep_enable_timer_wakeup(lastSleepSeconds * 1000000ULL);
+    
+    // Remember the wall clock so the next wake can continue from it
+    if (timeValid) {
+        epochAtSleepMs = nowEpochMs();
+        rtcAtSleepUs = esp_rtc_get_time_us();
+        sleepsSinceSync++;
+    }
+    
+    // Reported with the next upload (the radio is already off now)
+    lastAckToSleepMs = ackUs > 0 ? (esp_timer_get_time() - ackUs) / 1000 : 0;
+    lastSkippedDelayMs = skippedDelayMs;
     
     // Enter deep sleep
     esp_deep_sleep_start();
 }
 
+// Non-essential delay (serial flush, readability): skipped and tallied in fast-wake builds
+void wakeDelay(unsigned long ms)
+{
+#if FAST_WAKE
+    skippedDelayMs += ms;
+#else
+    delay(ms);
+#endif
+}
+
 void blinkLED(int times)
 {
+#if FAST_WAKE
+    skippedDelayMs += times * 200;
+#else
     for (int i = 0; i < times; i++) {
         digitalWrite(LED_PIN, HIGH);
         delay(100);
         digitalWrite(LED_PIN, LOW);
         delay(100);
     }
-}
\ No newline at end of file
+#endif
+}
+
+void restoreClock(bool timerWake)
+{
+    // RTC memory is only trustworthy after a timer wake
+    if (!timerWake) {
+        timeValid = false;
+        driftPpm = 0;
+        rtcSinceSyncMs = 0;
+        sleepsSinceSync = 0;
+        sntpBackoff = 0;
+        sntpSkipCycles = 0;
+    }
+    
+    if (!timeValid) {
+        LOG_PRINTLN("Clock: not set (waiting for SNTP)");
+        return;
+    }
+    
+    // The RTC timer runs through deep sleep, so it measures the sleep and the fixed wake-up
+    // overhead directly; only its clock error (driftPpm) has to be learned
+    uint64_t rtcNowUs = esp_rtc_get_time_us();
+    int64_t elapsedMs = rtcNowUs > rtcAtSleepUs ? (int64_t)((rtcNowUs - rtcAtSleepUs) / 1000) 
+                                                : lastSleepSeconds * 1000LL;
+    int64_t bootOffsetMs = elapsedMs - lastSleepSeconds * 1000LL;
+    int64_t driftMs = (int64_t)(elapsedMs * driftPpm / 1e6);
+    
+    epochAtBootMs = epochAtSleepMs + elapsedMs + driftMs - (int64_t)millis();
+    rtcSinceSyncMs += elapsedMs;
+    
+    LOG_PRINTF("Clock: %lld s (wake offset %lld ms, drift %.0f ppm = %lld ms, %d sleeps since sync)\n", 
+                  (long long)(nowEpochMs() / 1000), (long long)bootOffsetMs, driftPpm, 
+                  (long long)driftMs, sleepsSinceSync);
+}
+
+int64_t nowEpochMs()
+{
+    return timeValid ? epochAtBootMs + (int64_t)millis() : 0;
+}
+
+bool syncClockIfDue()
+{
+    if (timeValid && nowEpochMs() - lastSyncEpochMs < SNTP_RESYNC_INTERVAL) {
+        return false;
+    }
+    
+    // Failed attempts back off so an unreachable server doesn't cost SNTP_TIMEOUT every upload
+    if (sntpSkipCycles > 0) {
+        sntpSkipCycles--;
+        LOG_PRINTF("SNTP retry in %d upload(s)\n", sntpSkipCycles + 1);
+        return false;
+    }
+    
+    LOG_PRINTLN("Syncing clock via SNTP...");
+    unsigned long syncStart = millis();
+    
+    sntp_set_sync_status(SNTP_SYNC_STATUS_RESET);
+    configTime(0, 0, NTP_SERVER);
+    while (sntp_get_sync_status() != SNTP_SYNC_STATUS_COMPLETED && 
+           (millis() - syncStart) < SNTP_TIMEOUT) {
+        delay(10);
+    }
+    
+    bool synced = sntp_get_sync_status() == SNTP_SYNC_STATUS_COMPLETED;
+    sntp_stop(); // One-shot: no background polling while awake
+    
+    if (!synced) {
+        sntpBackoff = sntpBackoff == 0 ? 1 : min(sntpBackoff * 2, SNTP_MAX_BACKOFF);
+        sntpSkipCycles = sntpBackoff;
+        LOG_PRINTF("✗ SNTP timeout, keeping RTC estimate (next try in %d uploads)\n", sntpBackoff + 1);
+        return false;
+    }
+    sntpBackoff = 0;
+    
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    int64_t actualMs = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    
+    // Awake time comes from millis() and is accurate; the error is RTC drift over the time slept
+    if (timeValid && rtcSinceSyncMs > 0) {
+        int64_t errorMs = actualMs - nowEpochMs();
+        float ppm = driftPpm + errorMs * 1e6f / rtcSinceSyncMs;
+        driftPpm = constrain(ppm, -MAX_DRIFT_PPM, MAX_DRIFT_PPM);
+        LOG_PRINTF("  Drift: %lld ms over %d sleeps (%lld s) → %.0f ppm\n", (long long)errorMs, 
+                      sleepsSinceSync, (long long)(rtcSinceSyncMs / 1000), driftPpm);
+    }
+    
+    epochAtBootMs = actualMs - (int64_t)millis();
+    lastSyncEpochMs = actualMs;
+    rtcSinceSyncMs = 0;
+    sleepsSinceSync = 0;
+    timeValid = true;
+    
+    LOG_PRINTF("✓ Clock synced in %lu ms\n", millis() - syncStart);
+    return true;
+}
+
+void traceEvent(uint8_t type, uint8_t tag, uint16_t value)
+{
+    if (type == TRACE_FB_REQUEST && pendingRequests < 4) {
+        requestStart[pendingRequests++] = millis();
+    }
+    if (traceCount >= TRACE_CAPACITY) return;
+    
+    TraceEvent &event = traceBuffer[traceCount++];
+    event.timeMs = millis();
+    event.type = type;
+    event.tag = tag;
+    event.value = value;
+}
+
+void processData(AsyncResult &aResult)
+{
+    if (!aResult.isResult() || aResult.uid() == "authTask") return;
+    if (!aResult.isError() && !aResult.available()) return;
+    
+    traceResponse(!aResult.isError());
+    if (!aResult.isError() && aResult.uid() == "Send") {
+        uploadConfirmed = true;
+        ackUs = esp_timer_get_time();
+    }
+}
+
+void traceResponse(bool ok)
+{
+    // Responses arrive in request order on the single async client
+    unsigned long latency = 0;
+    if (pendingRequests > 0) {
+        latency = millis() - requestStart[0];
+        for (int i = 1; i < pendingRequests; i++) requestStart[i - 1] = requestStart[i];
+        pendingRequests--;
+    }
+    traceEvent(TRACE_FB_RESPONSE, ok ? 1 : 0, min(latency, 65535UL));
+}
+
+bool checkCycleBudget()
+{
+    unsigned long awakeMs = 0;
+    int requests = 0;
+    int requestBudget = BUDGET_REQUESTS;
+    float microAh = 0;
+    
+    for (int i = 0; i < traceCount; i++) {
+        const TraceEvent &event = traceBuffer[i];
+        if (event.type == TRACE_STAGE && i + 1 < traceCount) {
+            // A stage lasts until the next stage marker or the end of the trace
+            int next = i + 1;
+            while (next < traceCount - 1 && traceBuffer[next].type != TRACE_STAGE) next++;
+            microAh += (traceBuffer[next].timeMs - event.timeMs) * STAGE_MA[event.tag] / 3600.0; // mA x ms -> uAh
+        } else if (event.type == TRACE_FB_REQUEST) {
+            requests++;
+            if (event.tag == 3) requestBudget++; // Config rollout: the full fetch is expected
+        } else if (event.type == TRACE_END) {
+            awakeMs = event.timeMs;
+        }
+    }
+    
+    bool withinBudget = awakeMs <= BUDGET_AWAKE_MS && requests <= requestBudget && 
+                        microAh <= BUDGET_MICRO_AH;
+    
+    LOG_PRINTLN("\nCYCLE BUDGET:");
+    LOG_PRINTF("  Awake:    %lu / %lu ms\n", awakeMs, BUDGET_AWAKE_MS);
+    LOG_PRINTF("  Requests: %d / %d\n", requests, requestBudget);
+    LOG_PRINTF("  Charge:   %.1f / %lu uAh\n", microAh, BUDGET_MICRO_AH);
+    LOG_PRINTLN(withinBudget ? "✓ Within budget" : "✗ BUDGET EXCEEDED");
+    return withinBudget;
+}
+
+void dumpTrace()
+{
+    // "#TRACE v1 <sketch> <scenario> <events>" then 8-byte records as hex, 8 per line
+    LOG_PRINTF("#TRACE v1 power-strategy boot_%d %d\n", bootCount, traceCount);
+    const uint8_t *bytes = (const uint8_t *)traceBuffer;
+    for (int i = 0; i < traceCount * (int)sizeof(TraceEvent); i++) {
+        LOG_PRINTF("%02x", bytes[i]);
+        if (i % 64 == 63) LOG_PRINTLN();
+    }
+    LOG_PRINTLN("\n#END");
+}
+
+int readBatteryVoltage()
+{
+    uint32_t total = 0;
+    for (int i = 0; i < BATTERY_SAMPLES; i++) {
+        total += analogReadMilliVolts(BATTERY_PIN);
+    }
+    return (int)(total / BATTERY_SAMPLES * BATTERY_DIVIDER);
+}
+
+int socFromVoltage(int millivolts)
+{
+    if (millivolts >= DISCHARGE_CURVE[0].millivolts) return 100;
+    
+    // Linear interpolation between the surrounding curve points
+    for (int i = 1; i < CURVE_POINTS; i++) {
+        const CurvePoint &upper = DISCHARGE_CURVE[i - 1];
+        const CurvePoint &lower = DISCHARGE_CURVE[i];
+        if (millivolts >= lower.millivolts) {
+            return lower.percent + (millivolts - lower.millivolts) * (upper.percent - lower.percent) / 
+                                   (upper.millivolts - lower.millivolts);
+        }
+    }
+    return 0;
+}
+
+void selectProfile(int soc)
+{
+    int target = 0;
+    while (target < PROFILE_COUNT - 1 && soc < PROFILES[target].minSoc) target++;
+    
+    // Step back up only once SoC clears the richer threshold by the hysteresis margin
+    while (target < profileIndex && soc < PROFILES[target].minSoc + SOC_HYSTERESIS) target++;
+    
+    if (target != profileIndex) {
+        LOG_PRINTF("Profile: %s → %s\n", PROFILES[profileIndex].name, PROFILES[target].name);
+    }
+    profileIndex = target;
+}
+
+void queueReading(const float *distances, unsigned long readingMillis, int batteryMv)
+{
+    // Buffer full (uploads keep failing): drop the oldest reading
+    if (pendingCount >= MAX_PENDING) {
+        for (int i = 1; i < MAX_PENDING; i++) pendingReadings[i - 1] = pendingReadings[i];
+        pendingCount = MAX_PENDING - 1;
+    }
+    
+    PendingReading &reading = pendingReadings[pendingCount++];
+    for (int c = 0; c < SENSOR_COUNT; c++) reading.distances[c] = distances[c];
+    reading.boot = bootCount;
+    reading.epochMs = timeValid ? epochAtBootMs + readingMillis : 0;
+    reading.uptimeMs = readingMillis;
+    reading.batteryMv = batteryMv;
+}
+
+void loadConfig()
+{
+    Preferences prefs;
+    prefs.begin("config", true);
+    if (prefs.getBytesLength("device") == sizeof(config)) {
+        prefs.getBytes("device", &config, sizeof(config));
+    }
+    prefs.end();
+    
+    LOG_PRINTF("Config: v%d (sleep %lu s, %d WiFi attempts)\n", 
+                  config.version, config.sleepSeconds, config.maxWifiAttempts);
+}
+
+bool checkRemoteConfig()
+{
+    String path = "/config/" + deviceId();
+    
+    traceEvent(TRACE_FB_REQUEST, 2, 0);
+    int version = Database.get<int>(async_client, path + "/version");
+    bool ok = async_client.lastError().code() == 0;
+    traceResponse(ok);
+    if (!ok || version == config.version) return false;
+    
+    traceEvent(TRACE_FB_REQUEST, 3, 0);
+    String json = Database.get<String>(async_client, path);
+    ok = async_client.lastError().code() == 0;
+    traceResponse(ok);
+    if (!ok) {
+        LOG_PRINTLN("✗ Config fetch failed, keeping cached config");
+        return false;
+    }
+    
+    // Missing keys keep their current value; out-of-range values are clamped before the cast
+    DeviceConfig updated = config;
+    updated.version = version;
+    double value;
+    if (jsonNumber(json, "sleep_seconds", value)) {
+        updated.sleepSeconds = (unsigned long)constrain(value, 10.0, 86400.0);
+    }
+    if (jsonNumber(json, "max_wifi_attempts", value)) {
+        updated.maxWifiAttempts = (int)constrain(value, 1.0, 120.0);
+    }
+    config = updated;
+    
+    Preferences prefs;
+    prefs.begin("config", false);
+    prefs.putBytes("device", &config, sizeof(config));
+    prefs.end();
+    
+    LOG_PRINTF("✓ Config v%d applied (sleep %lu s, %d WiFi attempts)\n", 
+                  config.version, config.sleepSeconds, config.maxWifiAttempts);
+    return true;
+}
+
+bool jsonNumber(const String &json, const char *key, double &value)
+{
+    String needle = String("\"") + key + "\":";
+    int start = json.indexOf(needle);
+    if (start < 0) return false;
+    
+    value = atof(json.c_str() + start + needle.length());
+    return isfinite(value); // nan/inf would survive the clamp
+}
+
+unsigned long profileSleepSeconds(const PowerProfile &profile)
+{
+    return profile.sleepSeconds * config.sleepSeconds / PROFILES[0].sleepSeconds;
+}
+
+String deviceId()
+{
+    String mac = WiFi.macAddress();
+    mac.replace(":", "");
+    return mac;
+}
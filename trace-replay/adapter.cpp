@@ -0,0 +1,73 @@
+/**
+ * Builds one sketch image for replay: compiles the sketch itself against the
+ * host stand-ins in host/ and exposes the few hooks the driver needs.
+ * check-traces.sh builds it once per image, e.g.
+ *   -DREPLAY_1_MINUTE -DBUILD_MODE=3 -DTRACE_DUMP=1
+ */
+
+#include "replay-host.h"
+
+#if defined(REPLAY_POWER_STRATEGY)
+#include "../power-strategy.cpp"
+#elif defined(REPLAY_1_MINUTE)
+#include "../1-minute-5-stage-code.cpp"
+#elif defined(REPLAY_TRANSPASSINGRATE)
+#include "../transpassingrate.cpp"
+#else
+#error "Pick a sketch: REPLAY_POWER_STRATEGY, REPLAY_1_MINUTE or REPLAY_TRANSPASSINGRATE"
+#endif
+
+#if defined(REPLAY_POWER_STRATEGY)
+const char *const SKETCH_NAME = "power-strategy";
+const int SKETCH_BUILD = -1;
+#elif defined(REPLAY_1_MINUTE)
+const char *const SKETCH_NAME = "1-minute-5-stage";
+const int SKETCH_BUILD = BUILD_MODE;
+#else
+const char *const SKETCH_NAME = "transpassingrate";
+const int SKETCH_BUILD = BUILD_RATE;
+#endif
+
+void sketchWirePins()
+{
+#if defined(REPLAY_POWER_STRATEGY)
+    for (int i = 0; i < SENSOR_COUNT; i++) hostPairPins(SENSORS[i].trigPin, SENSORS[i].echoPin);
+#else
+    hostPairPins(TRIG_PIN, ECHO_PIN);
+#endif
+}
+
+void sketchConfigure(const std::map<std::string, unsigned long> &params)
+{
+#if defined(REPLAY_TRANSPASSINGRATE)
+    // Replay with the config the device was running; NVS is empty, so loadConfig() keeps it
+    auto duration = params.find("duration");
+    if (duration != params.end()) config.modeDuration = duration->second;
+    auto interval = params.find("interval");
+    if (interval != params.end()) config.intervals[currentMode] = interval->second;
+#endif
+}
+
+void sketchSetup()
+{
+    setup();
+}
+
+void sketchLoop()
+{
+    loop();
+}
+
+bool sketchTraceArmed()
+{
+    return traceCount > 0 && traceBuffer[0].type == TRACE_STAGE;
+}
+
+bool sketchCheckBudget()
+{
+#if defined(REPLAY_TRANSPASSINGRATE)
+    return checkModeBudget();
+#else
+    return checkCycleBudget();
+#endif
+}
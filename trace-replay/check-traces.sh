@@ -0,0 +1,50 @@
+#!/bin/sh
+# Build every sketch image for the host and replay each seed scenario through it;
+# non-zero exit if a scenario goes over budget or no image replays it.
+#   ./check-traces.sh            check traces/*.trace
+#   ./check-traces.sh --write    same, then replace each seed with the trace the sketch produced
+set -e
+cd "$(dirname "$0")"
+
+CXX="${CXX:-g++}"
+CXXFLAGS="-std=gnu++17 -O1 -g -Wall -Wno-unused-parameter -Ihost"
+mkdir -p build
+
+$CXX $CXXFLAGS -c host/host.cpp -o build/host.o
+$CXX $CXXFLAGS -c replay.cpp -o build/replay.o
+
+# image name, then the flags that select it
+image() {
+    name=$1
+    shift
+    $CXX $CXXFLAGS -include Arduino.h -DTRACE_DUMP=1 "$@" -c adapter.cpp -o "build/$name.o"
+    $CXX -o "build/replay-$name" build/replay.o build/host.o "build/$name.o"
+    IMAGES="$IMAGES $name"
+}
+
+IMAGES=""
+image power-strategy -DREPLAY_POWER_STRATEGY
+image 1-minute-cycle -DREPLAY_1_MINUTE -DBUILD_MODE=-1
+for mode in 0 1 2 3; do
+    image "1-minute-mode$mode" -DREPLAY_1_MINUTE -DBUILD_MODE=$mode
+done
+for rate in 0 1 2 3 4; do
+    image "transpassingrate-rate$rate" -DREPLAY_TRANSPASSINGRATE -DBUILD_RATE=$rate
+done
+
+status=0
+output=build/replay.log
+: > "$output"
+for name in $IMAGES; do
+    "./build/replay-$name" "$@" traces/*.trace > "build/$name.log" || status=1
+    tee -a "$output" < "build/$name.log"
+done
+
+# Every block has to be claimed by exactly one image
+blocks=$(cat traces/*.trace | grep -c '^#TRACE ')
+replayed=$(grep -c '^\(PASS\|FAIL\) ' "$output")
+if [ "$blocks" -ne "$replayed" ]; then
+    echo "$blocks scenario(s) in traces/, $replayed replayed"
+    status=1
+fi
+exit $status
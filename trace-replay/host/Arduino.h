@@ -0,0 +1,146 @@
+/**
+ * Host stand-in for the Arduino-ESP32 core, just enough to build the sketches
+ * for trace replay. Time is virtual: delay() and friends advance a simulated
+ * clock (see host.cpp) instead of sleeping, and every millis()/micros() call
+ * costs 1 us so busy-wait loops still make progress.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <math.h>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <sys/time.h>
+
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+class String {
+public:
+    String() {}
+    String(const char *text) : text_(text ? text : "") {}
+    String(const std::string &text) : text_(text) {}
+    String(char c) : text_(1, c) {}
+    String(int value) : text_(std::to_string(value)) {}
+    String(unsigned value) : text_(std::to_string(value)) {}
+    String(long value) : text_(std::to_string(value)) {}
+    String(unsigned long value) : text_(std::to_string(value)) {}
+    String(double value, unsigned decimals = 2);
+
+    const char *c_str() const { return text_.c_str(); }
+    unsigned length() const { return text_.size(); }
+    void reserve(unsigned size) { text_.reserve(size); }
+
+    String &operator+=(const String &other) { text_ += other.text_; return *this; }
+    String &operator+=(const char *other) { text_ += other; return *this; }
+    String &operator+=(char other) { text_ += other; return *this; }
+
+    bool operator==(const String &other) const { return text_ == other.text_; }
+    bool operator!=(const String &other) const { return text_ != other.text_; }
+    bool operator==(const char *other) const { return text_ == other; }
+    bool operator!=(const char *other) const { return text_ != other; }
+
+    int indexOf(const String &needle, unsigned from = 0) const;
+    String substring(unsigned from) const { return String(text_.substr(std::min<size_t>(from, text_.size()))); }
+    String substring(unsigned from, unsigned to) const;
+    void replace(const String &find, const String &with);
+    long toInt() const { return atol(text_.c_str()); }
+    float toFloat() const { return atof(text_.c_str()); }
+
+private:
+    std::string text_;
+};
+
+inline String operator+(const String &a, const String &b) { String result = a; result += b; return result; }
+inline String operator+(const String &a, const char *b) { String result = a; result += b; return result; }
+inline String operator+(const char *a, const String &b) { String result = a; result += b; return result; }
+
+class HardwareSerial {
+public:
+    void begin(unsigned long baud) {}
+    void end() {}
+    void flush() {}
+
+    size_t print(const String &text) { return write(text.c_str()); }
+    size_t print(const char *text) { return write(text); }
+    size_t print(char c) { char text[2] = { c, 0 }; return write(text); }
+    size_t print(int value) { return printf("%d", value); }
+    size_t print(unsigned value) { return printf("%u", value); }
+    size_t print(long value) { return printf("%ld", value); }
+    size_t print(unsigned long value) { return printf("%lu", value); }
+    size_t print(double value, int decimals = 2) { return printf("%.*f", decimals, value); }
+
+    template <class T> size_t println(T value) { return print(value) + println(); }
+    size_t println() { return write("\n"); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    size_t write(const char *text);
+};
+
+extern HardwareSerial Serial;
+
+// Time
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+unsigned long millis();
+unsigned long micros();
+void yield();
+
+// GPIO; echo pins are driven by the scenario being replayed
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout = 1000000L);
+uint32_t analogReadMilliVolts(uint8_t pin);
+void analogReadResolution(uint8_t bits);
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+#define digitalPinToInterrupt(p) (p)
+
+using std::min;
+using std::max;
+template <class T> T constrain(T x, T low, T high) { return x < low ? low : (x > high ? high : x); }
+
+class EspClass {
+public:
+    uint32_t getSketchSize() { return 1 << 20; }
+    uint32_t getFreeSketchSpace() { return 2 << 20; }
+    uint32_t getHeapSize() { return 320 << 10; }
+    uint32_t getFreeHeap() { return 240 << 10; }
+};
+
+extern EspClass ESP;
+
+// Sleep, timers, wall clock
+typedef enum {
+    ESP_SLEEP_WAKEUP_UNDEFINED,
+    ESP_SLEEP_WAKEUP_TIMER = 4
+} esp_sleep_wakeup_cause_t;
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause();
+int esp_sleep_enable_timer_wakeup(uint64_t us);
+void esp_deep_sleep_start();
+int64_t esp_timer_get_time();
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char *server1,
+                const char *server2 = nullptr, const char *server3 = nullptr);
+
+// The sketches read the wall clock straight from libc; route it to the virtual clock
+int hostGettimeofday(struct timeval *tv, void *tz);
+#define gettimeofday hostGettimeofday
@@ -0,0 +1,111 @@
+/**
+ * Host stand-in for the FirebaseClient subset the sketches use. Auth completes
+ * and every request is answered after the latency the replayed scenario
+ * recorded; async results are handed to their callback from FirebaseApp::loop(),
+ * sync calls block the calling task on the virtual clock.
+ */
+
+#pragma once
+
+#include "WiFiClientSecure.h"
+
+class UserAuth {
+public:
+    UserAuth(const char *apiKey, const char *email, const char *password, size_t expire = 3600) {}
+};
+
+struct user_auth_data {};
+template <class T> user_auth_data &getAuth(T &auth)
+{
+    static user_auth_data data;
+    return data;
+}
+
+class FirebaseError {
+public:
+    FirebaseError(int code = 0) : code_(code) {}
+    String message() const { return code_ == 0 ? String("") : String("request failed"); }
+    int code() const { return code_; }
+
+private:
+    int code_;
+};
+
+class AsyncResult {
+public:
+    AsyncResult(const String &uid, bool ok) : uid_(uid), ok_(ok) {}
+    bool isResult() { return true; }
+    bool isEvent() { return false; }
+    bool isError() { return !ok_; }
+    bool available() { return ok_; }
+    FirebaseError error() { return FirebaseError(ok_ ? 0 : -1); }
+    FirebaseError eventLog() { return FirebaseError(); }
+    String uid() { return uid_; }
+
+private:
+    String uid_;
+    bool ok_;
+};
+
+typedef void (*AsyncResultCallback)(AsyncResult &result);
+
+class AsyncClientClass {
+public:
+    AsyncClientClass(WiFiClientSecure &client) {}
+    FirebaseError lastError() { return FirebaseError(lastErrorCode); }
+
+    int lastErrorCode = 0;
+};
+
+class object_t {
+public:
+    object_t(const String &json) : json_(json) {}
+    String c_str() const { return json_; }
+
+private:
+    String json_;
+};
+
+class FirebaseApp {
+public:
+    void loop();
+    bool ready();
+    template <class T> void getApp(T &service) {}
+};
+
+void initializeApp(AsyncClientClass &client, FirebaseApp &app, user_auth_data &auth,
+                   AsyncResultCallback callback, const String &uid = "");
+
+// One request/response exchange on the virtual clock; latency and outcome come from the scenario
+void hostFirebaseAsync(AsyncResultCallback callback, const String &uid);
+bool hostFirebaseSync(int &version, String &json);
+
+class RealtimeDatabase {
+public:
+    void url(const String &url) {}
+
+    template <class T>
+    void update(AsyncClientClass &client, const String &path, const T &value,
+                AsyncResultCallback callback, const String &uid = "")
+    {
+        hostFirebaseAsync(callback, uid);
+    }
+
+    template <class T> T get(AsyncClientClass &client, const String &path);
+};
+
+template <> inline int RealtimeDatabase::get<int>(AsyncClientClass &client, const String &path)
+{
+    int version = 0;
+    String json;
+    client.lastErrorCode = hostFirebaseSync(version, json) ? 0 : -1;
+    return version;
+}
+
+template <> inline String RealtimeDatabase::get<String>(AsyncClientClass &client, const String &path)
+{
+    int version = 0;
+    String json;
+    client.lastErrorCode = hostFirebaseSync(version, json) ? 0 : -1;
+    return json;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "Arduino.h"
+
+// NVS starts empty on every replay, like a freshly erased flash
+class Preferences {
+public:
+    bool begin(const char *name, bool readOnly = false);
+    void end() {}
+    size_t getBytesLength(const char *key);
+    size_t getBytes(const char *key, void *buffer, size_t length);
+    size_t putBytes(const char *key, const void *value, size_t length);
+
+private:
+    std::string namespace_;
+};
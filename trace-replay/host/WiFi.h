@@ -0,0 +1,65 @@
+/**
+ * Host stand-in for the Arduino-ESP32 WiFi library. Connects succeed after the
+ * latency the replayed scenario recorded (host.cpp); events are delivered to
+ * onEvent() handlers on the virtual clock like the real WiFi event task would.
+ */
+
+#pragma once
+
+#include "Arduino.h"
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED = 6,
+    WL_STOPPED = 254
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1 } wifi_mode_t;
+
+typedef enum {
+    ARDUINO_EVENT_WIFI_STA_START,
+    ARDUINO_EVENT_WIFI_STA_CONNECTED,
+    ARDUINO_EVENT_WIFI_STA_GOT_IP,
+    ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+    ARDUINO_EVENT_WIFI_STA_STOP
+} arduino_event_id_t;
+typedef arduino_event_id_t WiFiEvent_t;
+
+typedef enum { WIFI_REASON_ASSOC_LEAVE = 8 } wifi_err_reason_t;
+
+struct arduino_event_info_t {
+    struct {
+        uint8_t reason;
+    } wifi_sta_disconnected;
+};
+typedef arduino_event_info_t WiFiEventInfo_t;
+
+class IPAddress {
+public:
+    String toString() const { return String("192.168.1.42"); }
+};
+
+class WiFiClass {
+public:
+    typedef void (*WiFiEventCb)(arduino_event_id_t event, arduino_event_info_t info);
+
+    wl_status_t begin(const char *ssid, const char *password);
+    bool reconnect();
+    bool disconnect(bool wifiOff = false, bool eraseAp = false);
+    bool mode(wifi_mode_t mode);
+    wl_status_t status();
+    bool isConnected() { return status() == WL_CONNECTED; }
+    bool setSleep(bool enabled) { return true; }
+    bool setAutoReconnect(bool enabled) { return true; }
+    int onEvent(WiFiEventCb handler);
+
+    String macAddress() { return String("24:58:7C:D1:0E:A4"); }
+    IPAddress localIP() { return IPAddress(); }
+    int8_t RSSI() { return -58; }
+};
+
+extern WiFiClass WiFi;
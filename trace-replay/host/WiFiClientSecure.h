@@ -0,0 +1,10 @@
+#pragma once
+
+#include "WiFi.h"
+
+class WiFiClientSecure {
+public:
+    void setInsecure() {}
+    void setHandshakeTimeout(unsigned long seconds) {}
+    void stop() {}
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef struct HostTask *TaskHandle_t;
+
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms)) // 1 kHz tick
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdPASS 1
+#define pdTRUE 1
+#define pdFALSE 0
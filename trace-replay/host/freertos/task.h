@@ -0,0 +1,11 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+// Tasks are cooperative coroutines on the virtual clock (host.cpp); a higher-priority task
+// that becomes ready takes over at the next clock read or blocking call, as with preemption
+BaseType_t xTaskCreate(void (*entry)(void *), const char *name, uint32_t stackDepth, void *param,
+                       UBaseType_t priority, TaskHandle_t *handle);
+void vTaskDelay(TickType_t ticks);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
@@ -0,0 +1,779 @@
+/**
+ * Host runtime for trace replay: a virtual microsecond clock, cooperative
+ * FreeRTOS tasks on ucontext, and the peripherals the sketches talk to, all
+ * driven by the scenario decoded from a #TRACE block.
+ * - Time only moves when a task blocks (delay(), vTaskDelay(), notify waits),
+ *   busy-waits (delayMicroseconds(), pulseIn()) or reads the clock (1 us per read)
+ * - Timed events (echo edges, WiFi events) fire in order as the clock passes them;
+ *   a higher-priority task that becomes ready takes over at the next clock read
+ * - Echo widths, connect latencies and Firebase response latencies are consumed in
+ *   the order the sketch asks for them, then fall back to the scenario defaults
+ */
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include "FirebaseClient.h"
+#include "Preferences.h"
+#include "esp_sntp.h"
+#include "esp_rtc_time.h"
+#include "freertos/task.h"
+#include "replay-host.h"
+
+#include <cstdarg>
+#include <functional>
+#include <queue>
+#include <vector>
+#include <ucontext.h>
+
+HardwareSerial Serial;
+WiFiClass WiFi;
+EspClass ESP;
+
+struct HostTask {
+    ucontext_t context;
+    std::vector<char> stack;
+    void (*entry)(void *);
+    void *param;
+    UBaseType_t priority;
+    uint64_t wakeUs;        // Ready once the clock reaches this (UINT64_MAX = blocked)
+    uint64_t readySeq;      // Round-robin order among equal priorities
+    uint32_t notifications;
+    bool waitingNotify;
+    bool finished;
+};
+
+namespace {
+
+const uint64_t NEVER = UINT64_MAX;
+const size_t TASK_STACK_BYTES = 256 * 1024;
+const uint64_t ECHO_RISE_US = 450;                // Trigger fall to echo rise (40 kHz burst)
+const uint64_t EPOCH_AT_SYNC_US = 1767225600ULL * 1000000ULL; // Wall clock once SNTP answers (2026-01-01)
+
+HostScenario scenario;
+uint64_t nowUs = 0;
+int dispatchDepth = 0;  // Inside a timed event (ISR / event task): no ticks, no task switches
+bool stopped = false;
+HostStop stopReason = HOST_STOP_IDLE;
+
+// Timed events
+struct TimedEvent {
+    uint64_t atUs;
+    uint64_t seq;
+    std::function<void()> fire;
+};
+
+struct FiresLater {
+    bool operator()(const TimedEvent &a, const TimedEvent &b) const
+    {
+        return a.atUs != b.atUs ? a.atUs > b.atUs : a.seq > b.seq;
+    }
+};
+
+std::priority_queue<TimedEvent, std::vector<TimedEvent>, FiresLater> timedEvents;
+uint64_t eventSeq = 0;
+
+// Tasks
+std::vector<HostTask *> tasks;
+HostTask *current = nullptr;
+ucontext_t schedulerContext;
+uint64_t readySeq = 0;
+
+// Serial
+std::string serialLine;
+std::string serialOutput;
+std::string dumpText;
+bool capturingDump = false;
+
+// GPIO
+struct PinState {
+    int level;
+    void (*isr)(void *);
+    void *isrArg;
+    int isrMode;
+    bool trigger;       // A sensor's trigger pin, answered on echoPin
+    uint8_t echoPin;
+    bool pulse;         // For echo pins: a pulse is scheduled or under way
+    uint64_t riseUs;
+    uint64_t fallUs;
+};
+
+PinState pins[64];
+
+// WiFi
+wl_status_t wifiStatus = WL_STOPPED;
+uint64_t wifiGeneration = 0;  // Bumped to cancel a pending connect
+std::vector<WiFiClass::WiFiEventCb> wifiHandlers;
+
+// Firebase
+struct PendingResponse {
+    uint64_t dueUs;
+    AsyncResultCallback callback;
+    String uid;
+    bool ok;
+};
+
+bool appInitialized = false;
+uint64_t appReadyUs = NEVER;
+std::deque<PendingResponse> pendingResponses;
+
+// SNTP
+bool sntpRunning = false;
+uint64_t sntpSyncUs = NEVER;
+bool wallClockSet = false;
+
+// NVS
+std::map<std::string, std::vector<uint8_t>> nvs;
+
+void schedule(uint64_t atUs, std::function<void()> fire)
+{
+    timedEvents.push({ atUs, eventSeq++, std::move(fire) });
+}
+
+void switchOut()
+{
+    HostTask *self = current;
+    swapcontext(&self->context, &schedulerContext);
+}
+
+void stop(HostStop reason)
+{
+    if (!stopped) {
+        stopped = true;
+        stopReason = reason;
+    }
+    // A stopped task is never resumed; the driver only inspects the sketch's globals from here
+    if (current && dispatchDepth == 0) switchOut();
+}
+
+bool isReady(const HostTask *task)
+{
+    return !task->finished && task->wakeUs <= nowUs;
+}
+
+void preemptIfNeeded()
+{
+    if (!current || dispatchDepth > 0) return;
+    for (HostTask *task : tasks) {
+        if (task != current && isReady(task) && task->priority > current->priority) {
+            current->wakeUs = nowUs;
+            current->readySeq = readySeq++;
+            switchOut();
+            return;
+        }
+    }
+}
+
+void advanceTo(uint64_t targetUs)
+{
+    while (!timedEvents.empty() && timedEvents.top().atUs <= targetUs) {
+        TimedEvent event = timedEvents.top();
+        timedEvents.pop();
+        nowUs = max(nowUs, event.atUs);
+        dispatchDepth++;
+        event.fire();
+        dispatchDepth--;
+    }
+    nowUs = max(nowUs, targetUs);
+
+    if (nowUs > scenario.limitUs) stop(HOST_STOP_TIMEOUT);
+    preemptIfNeeded();
+}
+
+// Every clock read from task code costs a microsecond, so polling loops terminate
+void tick()
+{
+    if (current && dispatchDepth == 0) advanceTo(nowUs + 1);
+}
+
+// Recorded latencies are millis() differences, so they count from the current millisecond;
+// replaying them from the exact microsecond would let every replay add a poll period
+uint64_t msFromNow(unsigned long ms)
+{
+    return (nowUs / 1000 + ms) * 1000;
+}
+
+void block(uint64_t wakeUs)
+{
+    if (!current) {
+        advanceTo(wakeUs);
+        return;
+    }
+    current->wakeUs = wakeUs;
+    current->readySeq = readySeq++;
+    switchOut();
+}
+
+void taskTrampoline()
+{
+    current->entry(current->param);
+    current->finished = true; // FreeRTOS tasks must not return; treat it as deleted
+    switchOut();
+}
+
+void loopTask(void *param)
+{
+    sketchSetup();
+    for (;;) {
+        sketchLoop();
+        tick();
+    }
+}
+
+int inputsDefaulted = 0;
+
+template <class T> T takeNext(std::deque<T> &queue, T fallback)
+{
+    if (queue.empty()) {
+        inputsDefaulted++;
+        return fallback;
+    }
+    T value = queue.front();
+    queue.pop_front();
+    return value;
+}
+
+void setLevel(uint8_t pin, int level)
+{
+    PinState &state = pins[pin];
+    if (state.level == level) return;
+    state.level = level;
+
+    bool fires = state.isrMode == CHANGE || (state.isrMode == RISING && level) ||
+                 (state.isrMode == FALLING && !level);
+    if (state.isr && fires) state.isr(state.isrArg);
+}
+
+void fireEcho(uint8_t echoPin)
+{
+    PinState &echo = pins[echoPin];
+    unsigned long widthUs = takeNext(scenario.echoUs, (uint16_t)scenario.defaultEchoUs);
+    echo.pulse = widthUs > 0;
+    if (!echo.pulse) return;
+
+    echo.riseUs = nowUs + ECHO_RISE_US;
+    echo.fallUs = echo.riseUs + widthUs;
+    schedule(echo.riseUs, [echoPin] { setLevel(echoPin, HIGH); });
+    schedule(echo.fallUs, [echoPin] { setLevel(echoPin, LOW); pins[echoPin].pulse = false; });
+}
+
+void wifiEvent(arduino_event_id_t event, uint8_t reason)
+{
+    // Delivered from the event task: after the call that caused it returns
+    schedule(nowUs, [event, reason] {
+        arduino_event_info_t info = {};
+        info.wifi_sta_disconnected.reason = reason;
+        for (WiFiClass::WiFiEventCb handler : wifiHandlers) handler(event, info);
+    });
+}
+
+void startConnect()
+{
+    uint64_t generation = ++wifiGeneration;
+    unsigned long latencyMs = takeNext(scenario.connectMs, (uint16_t)scenario.defaultConnectMs);
+    if (latencyMs == 0) return; // The AP never answers; the sketch's own timeout has to notice
+
+    schedule(msFromNow(latencyMs), [generation] {
+        if (generation != wifiGeneration) return;
+        wifiStatus = WL_CONNECTED;
+        wifiEvent(ARDUINO_EVENT_WIFI_STA_GOT_IP, 0);
+    });
+}
+
+void dropLink()
+{
+    wifiGeneration++;
+    if (wifiStatus == WL_CONNECTED) wifiEvent(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, WIFI_REASON_ASSOC_LEAVE);
+}
+
+bool nextResponse(unsigned long &latencyMs)
+{
+    // Until the sketch starts the trace being replayed, its requests were not recorded
+    if (!sketchTraceArmed()) {
+        latencyMs = scenario.defaultResponseMs;
+        return true;
+    }
+    bool ok = scenario.responseOk.empty() || scenario.responseOk.front();
+    if (!scenario.responseOk.empty()) scenario.responseOk.pop_front();
+    latencyMs = takeNext(scenario.responseMs, (uint16_t)scenario.defaultResponseMs);
+    return ok;
+}
+
+void serialLineDone(const std::string &line)
+{
+    serialOutput += line + "\n";
+    if (scenario.verbose) printf("[%10.3f] %s\n", nowUs / 1e6, line.c_str());
+
+    if (line.rfind("#TRACE ", 0) == 0) {
+        capturingDump = true;
+        dumpText.clear();
+    }
+    if (!capturingDump) return;
+
+    dumpText += line + "\n";
+    if (line == "#END") {
+        capturingDump = false;
+        stop(HOST_STOP_DUMP);
+    }
+}
+
+} // namespace
+
+// --- Driver interface ---
+
+HostStop hostRun(const HostScenario &input)
+{
+    scenario = input;
+    sketchWirePins();
+
+    HostTask *loop = nullptr;
+    xTaskCreate(loopTask, "loopTask", 8192, nullptr, 1, &loop);
+
+    while (!stopped) {
+        HostTask *next = nullptr;
+        for (HostTask *task : tasks) {
+            if (!isReady(task)) continue;
+            if (!next || task->priority > next->priority ||
+                (task->priority == next->priority && task->readySeq < next->readySeq)) {
+                next = task;
+            }
+        }
+
+        if (!next) {
+            // Idle: jump to whatever happens next
+            uint64_t wakeUs = timedEvents.empty() ? NEVER : timedEvents.top().atUs;
+            for (HostTask *task : tasks) {
+                if (!task->finished) wakeUs = min(wakeUs, task->wakeUs);
+            }
+            if (wakeUs == NEVER) {
+                stop(HOST_STOP_IDLE);
+                break;
+            }
+            advanceTo(wakeUs);
+            continue;
+        }
+
+        current = next;
+        swapcontext(&schedulerContext, &next->context);
+        current = nullptr;
+    }
+    return stopReason;
+}
+
+void hostPairPins(uint8_t trigPin, uint8_t echoPin)
+{
+    pins[trigPin].trigger = true;
+    pins[trigPin].echoPin = echoPin;
+}
+
+uint64_t hostNowUs()
+{
+    return nowUs;
+}
+
+HostInputUse hostInputUse()
+{
+    HostInputUse use;
+    use.unused = scenario.echoUs.size() + scenario.connectMs.size() + scenario.responseMs.size();
+    use.defaulted = inputsDefaulted;
+    return use;
+}
+
+std::string hostDump()
+{
+    return dumpText;
+}
+
+std::string hostTakeOutput()
+{
+    std::string output;
+    output.swap(serialOutput);
+    return output;
+}
+
+// --- Arduino core ---
+
+String::String(double value, unsigned decimals)
+{
+    char text[64];
+    snprintf(text, sizeof(text), "%.*f", (int)decimals, value);
+    text_ = text;
+}
+
+int String::indexOf(const String &needle, unsigned from) const
+{
+    size_t found = text_.find(needle.text_, from);
+    return found == std::string::npos ? -1 : (int)found;
+}
+
+String String::substring(unsigned from, unsigned to) const
+{
+    if (from > to) std::swap(from, to);
+    from = min<unsigned>(from, text_.size());
+    to = min<unsigned>(to, text_.size());
+    return String(text_.substr(from, to - from));
+}
+
+void String::replace(const String &find, const String &with)
+{
+    if (find.text_.empty()) return;
+    size_t at = 0;
+    while ((at = text_.find(find.text_, at)) != std::string::npos) {
+        text_.replace(at, find.text_.size(), with.text_);
+        at += with.text_.size();
+    }
+}
+
+size_t HardwareSerial::printf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(nullptr, 0, format, copy);
+    va_end(copy);
+
+    std::vector<char> text(length + 1);
+    vsnprintf(text.data(), text.size(), format, args);
+    va_end(args);
+    return write(text.data());
+}
+
+size_t HardwareSerial::write(const char *text)
+{
+    size_t length = strlen(text);
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '\n') {
+            std::string line;
+            line.swap(serialLine);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            serialLineDone(line);
+        } else {
+            serialLine += text[i];
+        }
+    }
+    return length;
+}
+
+void delay(unsigned long ms)
+{
+    block(nowUs + ms * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    advanceTo(nowUs + us);
+}
+
+unsigned long millis()
+{
+    tick();
+    return nowUs / 1000;
+}
+
+unsigned long micros()
+{
+    tick();
+    return nowUs;
+}
+
+void yield()
+{
+    block(nowUs);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    int previous = pins[pin].level;
+    setLevel(pin, value ? HIGH : LOW);
+
+    // The sensor bursts on the falling edge of its trigger pulse
+    if (pins[pin].trigger && previous == HIGH && !value) fireEcho(pins[pin].echoPin);
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pins[pin].level;
+}
+
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout)
+{
+    const PinState &echo = pins[pin];
+    uint64_t deadlineUs = nowUs + timeout;
+    if (!echo.pulse || echo.fallUs > deadlineUs) {
+        advanceTo(deadlineUs);
+        return 0;
+    }
+
+    uint64_t widthUs = echo.fallUs - echo.riseUs;
+    advanceTo(echo.fallUs);
+    return widthUs;
+}
+
+uint32_t analogReadMilliVolts(uint8_t pin)
+{
+    return scenario.batteryMv / 2; // The battery sits behind a 2:1 divider
+}
+
+void analogReadResolution(uint8_t bits) {}
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode)
+{
+    pins[pin].isr = handler;
+    pins[pin].isrArg = arg;
+    pins[pin].isrMode = mode;
+}
+
+void detachInterrupt(uint8_t pin)
+{
+    pins[pin].isr = nullptr;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause()
+{
+    return ESP_SLEEP_WAKEUP_UNDEFINED; // Every replay is a fresh boot
+}
+
+int esp_sleep_enable_timer_wakeup(uint64_t us)
+{
+    return 0;
+}
+
+void esp_deep_sleep_start()
+{
+    stop(HOST_STOP_SLEEP);
+}
+
+int64_t esp_timer_get_time()
+{
+    tick();
+    return nowUs;
+}
+
+uint64_t esp_rtc_get_time_us(void)
+{
+    return nowUs;
+}
+
+// --- SNTP ---
+
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char *server1,
+                const char *server2, const char *server3)
+{
+    sntpRunning = true;
+    sntpSyncUs = scenario.sntpMs > 0 ? nowUs + scenario.sntpMs * 1000ULL : NEVER;
+}
+
+sntp_sync_status_t sntp_get_sync_status(void)
+{
+    if (!sntpRunning) return SNTP_SYNC_STATUS_RESET;
+    if (nowUs < sntpSyncUs) return SNTP_SYNC_STATUS_IN_PROGRESS;
+    wallClockSet = true;
+    return SNTP_SYNC_STATUS_COMPLETED;
+}
+
+void sntp_set_sync_status(sntp_sync_status_t status) {}
+
+void sntp_stop(void)
+{
+    sntp_get_sync_status(); // A reply that already arrived still set the clock
+    sntpRunning = false;
+}
+
+int hostGettimeofday(struct timeval *tv, void *tz)
+{
+    if (sntpRunning) sntp_get_sync_status();
+    uint64_t us = wallClockSet ? EPOCH_AT_SYNC_US + nowUs : nowUs;
+    tv->tv_sec = us / 1000000;
+    tv->tv_usec = us % 1000000;
+    return 0;
+}
+
+// --- FreeRTOS ---
+
+BaseType_t xTaskCreate(void (*entry)(void *), const char *name, uint32_t stackDepth, void *param,
+                       UBaseType_t priority, TaskHandle_t *handle)
+{
+    HostTask *task = new HostTask();
+    task->stack.resize(TASK_STACK_BYTES);
+    task->entry = entry;
+    task->param = param;
+    task->priority = priority;
+    task->wakeUs = nowUs;
+    task->readySeq = readySeq++;
+
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = task->stack.data();
+    task->context.uc_stack.ss_size = task->stack.size();
+    task->context.uc_link = nullptr;
+    makecontext(&task->context, taskTrampoline, 0);
+
+    tasks.push_back(task);
+    if (handle) *handle = task;
+    preemptIfNeeded();
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    block(nowUs + ticks * 1000ULL);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait)
+{
+    HostTask *self = current;
+    if (self->notifications == 0 && ticksToWait > 0) {
+        self->waitingNotify = true;
+        block(ticksToWait == portMAX_DELAY ? NEVER : nowUs + ticksToWait * 1000ULL);
+        self->waitingNotify = false;
+    }
+
+    uint32_t count = self->notifications;
+    if (clearOnExit) {
+        self->notifications = 0;
+    } else if (count > 0) {
+        self->notifications--;
+    }
+    return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    task->notifications++;
+    if (task->waitingNotify) {
+        task->waitingNotify = false;
+        task->wakeUs = nowUs;
+        task->readySeq = readySeq++;
+        preemptIfNeeded();
+    }
+    return pdPASS;
+}
+
+// --- WiFi ---
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *password)
+{
+    dropLink();
+    wifiStatus = WL_DISCONNECTED;
+    startConnect();
+    return wifiStatus;
+}
+
+bool WiFiClass::reconnect()
+{
+    dropLink();
+    wifiStatus = WL_DISCONNECTED;
+    startConnect();
+    return true;
+}
+
+bool WiFiClass::disconnect(bool wifiOff, bool eraseAp)
+{
+    dropLink();
+    wifiStatus = WL_DISCONNECTED;
+    if (wifiOff) mode(WIFI_OFF);
+    return true;
+}
+
+bool WiFiClass::mode(wifi_mode_t mode)
+{
+    if (mode == WIFI_OFF) {
+        dropLink();
+        wifiStatus = WL_STOPPED;
+    } else if (wifiStatus == WL_STOPPED) {
+        wifiStatus = WL_DISCONNECTED;
+    }
+    return true;
+}
+
+wl_status_t WiFiClass::status()
+{
+    return wifiStatus;
+}
+
+int WiFiClass::onEvent(WiFiEventCb handler)
+{
+    wifiHandlers.push_back(handler);
+    return wifiHandlers.size();
+}
+
+// --- Firebase ---
+
+void initializeApp(AsyncClientClass &client, FirebaseApp &app, user_auth_data &auth,
+                   AsyncResultCallback callback, const String &uid)
+{
+    appInitialized = true;
+    appReadyUs = nowUs + scenario.authMs * 1000ULL;
+}
+
+bool FirebaseApp::ready()
+{
+    return appInitialized && nowUs >= appReadyUs;
+}
+
+void FirebaseApp::loop()
+{
+    while (!pendingResponses.empty() && pendingResponses.front().dueUs <= nowUs) {
+        PendingResponse response = pendingResponses.front();
+        pendingResponses.pop_front();
+        AsyncResult result(response.uid, response.ok);
+        if (response.callback) response.callback(result);
+    }
+}
+
+void hostFirebaseAsync(AsyncResultCallback callback, const String &uid)
+{
+    unsigned long latencyMs;
+    bool ok = nextResponse(latencyMs);
+
+    // One async client: answers come back in request order
+    uint64_t dueUs = msFromNow(latencyMs);
+    if (!pendingResponses.empty()) dueUs = max(dueUs, pendingResponses.back().dueUs);
+    pendingResponses.push_back({ dueUs, callback, uid, ok });
+}
+
+bool hostFirebaseSync(int &version, String &json)
+{
+    unsigned long latencyMs;
+    bool ok = nextResponse(latencyMs);
+    block(msFromNow(latencyMs));
+
+    version = scenario.configVersion;
+    if (scenario.configJson.empty()) {
+        json = String("{\"version\":") + String(version) + "}";
+    } else {
+        json = String(scenario.configJson);
+    }
+    return ok;
+}
+
+// --- NVS ---
+
+bool Preferences::begin(const char *name, bool readOnly)
+{
+    namespace_ = name;
+    return true;
+}
+
+size_t Preferences::getBytesLength(const char *key)
+{
+    auto found = nvs.find(namespace_ + "/" + key);
+    return found == nvs.end() ? 0 : found->second.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t length)
+{
+    auto found = nvs.find(namespace_ + "/" + key);
+    if (found == nvs.end()) return 0;
+    length = min(length, found->second.size());
+    memcpy(buffer, found->second.data(), length);
+    return length;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t length)
+{
+    const uint8_t *bytes = (const uint8_t *)value;
+    nvs[namespace_ + "/" + key].assign(bytes, bytes + length);
+    return length;
+}
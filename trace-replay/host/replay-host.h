@@ -0,0 +1,63 @@
+/**
+ * Control interface between the replay driver (replay.cpp), the host runtime
+ * (host.cpp) and the sketch under replay (adapter.cpp). Only std types here,
+ * so the driver never sees the sketch's globals or the Arduino stand-ins.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+
+// What the outside world does during one replayed scenario
+struct HostScenario {
+    std::deque<uint16_t> echoUs;      // Echo pulse widths in trigger order (0 = no echo)
+    std::deque<uint16_t> connectMs;   // WiFi begin()/reconnect() to GOT_IP, per attempt (0 = never)
+    std::deque<uint16_t> responseMs;  // Firebase request to response, in request order
+    std::deque<bool> responseOk;
+    
+    unsigned long defaultEchoUs = 5831;     // 100 cm, once the recorded echoes run out
+    unsigned long defaultConnectMs = 2500;
+    unsigned long defaultResponseMs = 600;
+    unsigned long authMs = 1500;            // initializeApp() to app.ready()
+    unsigned long sntpMs = 300;             // configTime() to a completed sync (0 = no reply)
+    unsigned long batteryMv = 4000;
+    int configVersion = 0;                  // /config/<id>/version as served
+    std::string configJson;                 // /config/<id> as served ("" = just the version)
+    
+    uint64_t limitUs = 0;                   // Virtual time the sketch gets to finish its dump
+    bool verbose = false;                   // Echo the sketch's serial output
+};
+
+enum HostStop {
+    HOST_STOP_DUMP,     // Printed a complete #TRACE ... #END block
+    HOST_STOP_SLEEP,    // esp_deep_sleep_start() without a dump
+    HOST_STOP_TIMEOUT,  // Ran past limitUs
+    HOST_STOP_IDLE      // Every task blocked forever
+};
+
+// host.cpp
+HostStop hostRun(const HostScenario &scenario);
+void hostPairPins(uint8_t trigPin, uint8_t echoPin); // Falling trigger edge fires the next echo
+uint64_t hostNowUs();
+// How far the sketch's requests for echoes, connects and responses matched the recording
+struct HostInputUse {
+    int unused;
+    int defaulted;
+};
+
+HostInputUse hostInputUse();
+std::string hostDump();         // Last #TRACE ... #END block the sketch printed
+std::string hostTakeOutput();   // Serial output since the previous call
+
+// adapter.cpp, built once per sketch image
+extern const char *const SKETCH_NAME;
+extern const int SKETCH_BUILD;  // BUILD_MODE / BUILD_RATE of this image, -1 = all
+void sketchWirePins();
+void sketchConfigure(const std::map<std::string, unsigned long> &params);
+void sketchSetup();
+void sketchLoop();
+bool sketchTraceArmed();        // The sketch's scenario trace has started (responses come from the input)
+bool sketchCheckBudget();       // The sketch's own budget check over its final trace
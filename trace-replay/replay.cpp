@@ -0,0 +1,369 @@
+/**
+ * Host-side trace replayer
+ * Re-runs the scenarios in "#TRACE v1" dumps (TRACE_DUMP 1, or any cycle/mode
+ * that blows its budget) through the sketch's own code: the sketch is compiled
+ * for the host (adapter.cpp + host/) and its setup()/loop()/tasks run on a
+ * virtual clock, fed the echo widths, WiFi connect times and Firebase latencies
+ * the dump recorded. The trace the sketch produces is then judged by the
+ * sketch's own budget check, so no budget or timing constant is copied here.
+ *
+ * One binary per sketch image; each replays the blocks recorded by its image
+ * and skips the rest. check-traces.sh builds them all and runs every seed:
+ *   ./build/replay-transpassingrate-rate4 traces/transpassingrate-rate-4.trace serial-log.txt
+ *   ./build/replay-1-minute-mode1 -v traces/1-minute-mode-1.trace   (sketch output)
+ *   ./build/replay-power-strategy --write traces/power-strategy-upload.trace
+ *
+ * --write replaces the block with the trace the sketch just produced, keeping
+ * the scenario name, header parameters and comments (one block per file).
+ * Input can be a raw serial log; everything outside #TRACE ... #END is ignored.
+ * Scenario parameters (key=value after the event count, all optional):
+ *   auth_ms, sntp_ms, battery_mv, config_version, echo_us, connect_ms, response_ms
+ */
+
+#include "host/replay-host.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Same layout as TraceEvent in the sketches (little-endian, 8 bytes)
+enum TraceType : uint8_t {
+    TRACE_STAGE = 1,
+    TRACE_ECHO = 2,
+    TRACE_WIFI = 3,
+    TRACE_FB_REQUEST = 4,
+    TRACE_FB_RESPONSE = 5,
+    TRACE_END = 6
+};
+
+const uint8_t WIFI_CONNECTED = 3; // wl_status_t WL_CONNECTED
+
+struct TraceEvent {
+    uint32_t timeMs;
+    uint8_t type;
+    uint8_t tag;
+    uint16_t value;
+};
+
+struct Trace {
+    std::string path;
+    int headerLine;
+    int endLine;
+    std::string sketch;
+    std::string scenario;
+    std::vector<std::pair<std::string, unsigned long>> params; // In header order
+    std::vector<TraceEvent> events;
+};
+
+bool parseTraces(const char *path, std::vector<Trace> &traces)
+{
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return false;
+    }
+
+    std::string line;
+    std::string hex;
+    Trace *current = nullptr;
+    size_t expected = 0;
+    int lineNo = 0;
+
+    while (std::getline(in, line)) {
+        lineNo++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+
+        if (line.rfind("#TRACE ", 0) == 0) {
+            std::istringstream header(line.substr(7));
+            std::string version;
+            traces.push_back(Trace());
+            current = &traces.back();
+            current->path = path;
+            current->headerLine = lineNo;
+            header >> version >> current->sketch >> current->scenario >> expected;
+            if (version != "v1" || current->sketch.empty() || header.fail()) {
+                fprintf(stderr, "%s:%d: bad #TRACE header\n", path, lineNo);
+                return false;
+            }
+
+            std::string token;
+            while (header >> token) {
+                size_t eq = token.find('=');
+                if (eq != std::string::npos) {
+                    current->params.push_back({ token.substr(0, eq), strtoul(token.c_str() + eq + 1, nullptr, 10) });
+                }
+            }
+            hex.clear();
+            continue;
+        }
+        if (!current) continue; // Serial chatter between dumps
+
+        if (line.rfind("#END", 0) == 0) {
+            if (hex.size() != expected * sizeof(TraceEvent) * 2) {
+                fprintf(stderr, "%s:%d: expected %zu events, got %zu hex digits\n",
+                        path, current->headerLine, expected, hex.size());
+                return false;
+            }
+            for (size_t i = 0; i < expected; i++) {
+                uint8_t bytes[sizeof(TraceEvent)];
+                for (size_t b = 0; b < sizeof(TraceEvent); b++) {
+                    bytes[b] = (uint8_t)strtoul(hex.substr((i * sizeof(TraceEvent) + b) * 2, 2).c_str(), nullptr, 16);
+                }
+                TraceEvent event;
+                event.timeMs = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+                event.type = bytes[4];
+                event.tag = bytes[5];
+                event.value = bytes[6] | bytes[7] << 8;
+                current->events.push_back(event);
+            }
+            current->endLine = lineNo;
+            current = nullptr;
+            continue;
+        }
+
+        for (char c : line) {
+            if (isxdigit((unsigned char)c)) hex += c;
+        }
+    }
+
+    if (current) {
+        fprintf(stderr, "%s:%d: missing #END\n", path, current->headerLine);
+        return false;
+    }
+    return true;
+}
+
+bool findParam(const Trace &trace, const char *key, unsigned long &value)
+{
+    for (const auto &param : trace.params) {
+        if (param.first == key) {
+            value = param.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+// BUILD_MODE / BUILD_RATE of the image that recorded the trace
+int recordedBuild(const Trace &trace)
+{
+    unsigned long build;
+    if (findParam(trace, "build", build)) return (int)(long)build;
+
+    // Older dumps: a trace that only ever enters one mode came from that mode's image
+    std::set<int> stages;
+    for (const TraceEvent &event : trace.events) {
+        if (event.type == TRACE_STAGE) stages.insert(event.tag);
+    }
+    return stages.size() == 1 ? *stages.begin() : -1;
+}
+
+bool handles(const Trace &trace)
+{
+    if (trace.sketch != SKETCH_NAME) return false;
+    if (trace.sketch == "power-strategy") return true;
+    if (trace.sketch == "transpassingrate") {
+        // Rates are replayed one per image, whichever image recorded them
+        for (const TraceEvent &event : trace.events) {
+            if (event.type == TRACE_STAGE) return event.tag == SKETCH_BUILD;
+        }
+        return false;
+    }
+    return recordedBuild(trace) == SKETCH_BUILD;
+}
+
+HostScenario buildScenario(const Trace &trace, bool verbose)
+{
+    HostScenario scenario;
+    unsigned long value;
+    if (findParam(trace, "echo_us", value)) scenario.defaultEchoUs = value;
+    if (findParam(trace, "connect_ms", value)) scenario.defaultConnectMs = value;
+    if (findParam(trace, "response_ms", value)) scenario.defaultResponseMs = value;
+    if (findParam(trace, "auth_ms", value)) scenario.authMs = value;
+    if (findParam(trace, "sntp_ms", value)) scenario.sntpMs = value;
+    if (findParam(trace, "battery_mv", value)) scenario.batteryMv = value;
+    if (findParam(trace, "config_version", value)) scenario.configVersion = (int)value;
+
+    uint32_t lastMs = 0;
+    for (const TraceEvent &event : trace.events) {
+        lastMs = event.timeMs;
+        if (event.type == TRACE_ECHO) {
+            scenario.echoUs.push_back(event.value);
+        } else if (event.type == TRACE_WIFI && event.tag == WIFI_CONNECTED) {
+            // Connect time rides in the value; dumps from before it did get the default
+            scenario.connectMs.push_back(event.value > 0 ? event.value : scenario.defaultConnectMs);
+        } else if (event.type == TRACE_FB_RESPONSE) {
+            scenario.responseMs.push_back(event.value);
+            scenario.responseOk.push_back(event.tag != 0);
+        }
+    }
+
+    // Room for setup()'s own waits on top of the recorded span
+    unsigned long durationMs = 0;
+    findParam(trace, "duration", durationMs);
+    scenario.limitUs = (uint64_t)(std::max<unsigned long>(lastMs, durationMs) + 120000) * 1000;
+    scenario.verbose = verbose;
+    return scenario;
+}
+
+std::map<std::string, unsigned long> paramMap(const Trace &trace)
+{
+    std::map<std::string, unsigned long> params;
+    for (const auto &param : trace.params) params[param.first] = param.second;
+    return params;
+}
+
+// Swaps the block in its file for the dump the sketch just printed
+bool writeTrace(const Trace &trace, const std::string &dump)
+{
+    std::istringstream in(dump);
+    std::string header;
+    std::getline(in, header);
+    std::istringstream fields(header.substr(7));
+    std::string version, sketch, scenario, count, token;
+    fields >> version >> sketch >> scenario >> count;
+
+    // The sketch's own parameters win; scenario inputs it doesn't know about are kept
+    std::string merged = "#TRACE v1 " + sketch + " " + trace.scenario + " " + count;
+    std::set<std::string> keys;
+    while (fields >> token) {
+        merged += " " + token;
+        keys.insert(token.substr(0, token.find('=')));
+    }
+    for (const auto &param : trace.params) {
+        if (!keys.count(param.first)) merged += " " + param.first + "=" + std::to_string(param.second);
+    }
+
+    std::ifstream original(trace.path);
+    std::string text, line;
+    int lineNo = 0;
+    while (std::getline(original, line)) {
+        lineNo++;
+        if (lineNo == trace.headerLine) {
+            text += merged + "\n";
+            std::string body;
+            while (std::getline(in, body)) {
+                if (!body.empty()) text += body + "\n";
+            }
+        } else if (lineNo < trace.headerLine || lineNo > trace.endLine) {
+            text += line + "\n";
+        }
+    }
+    original.close();
+
+    std::ofstream out(trace.path);
+    out << text;
+    return out.good();
+}
+
+void printIndented(const std::string &text)
+{
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty()) printf("    %s\n", line.c_str());
+    }
+}
+
+// Runs in a forked child: the sketch's globals start from scratch for every scenario
+int replay(const Trace &trace, bool write, bool verbose)
+{
+    HostScenario scenario = buildScenario(trace, verbose);
+    sketchConfigure(paramMap(trace));
+    HostStop stop = hostRun(scenario);
+    double seconds = hostNowUs() / 1e6;
+
+    const char *problem = nullptr;
+    if (stop == HOST_STOP_SLEEP) problem = "slept without dumping its trace (built without TRACE_DUMP?)";
+    if (stop == HOST_STOP_TIMEOUT) problem = "did not finish within the scenario's time limit";
+    if (stop == HOST_STOP_IDLE) problem = "stalled: every task blocked forever";
+    if (problem) {
+        printf("FAIL %s %s (%s:%d): %s at %.3f s\n", trace.sketch.c_str(), trace.scenario.c_str(),
+               trace.path.c_str(), trace.headerLine, problem, seconds);
+        return 1;
+    }
+
+    hostTakeOutput();
+    bool ok = sketchCheckBudget();
+    std::string budget = hostTakeOutput();
+    printf("%s %s %s (%s:%d), dumped at %.3f s\n", ok ? "PASS" : "FAIL", trace.sketch.c_str(),
+           trace.scenario.c_str(), trace.path.c_str(), trace.headerLine, seconds);
+    printIndented(budget);
+
+    // Recorded inputs left over or run short: the sketch no longer behaves the way the recording did
+    HostInputUse use = hostInputUse();
+    if (use.unused > 0 || use.defaulted > 0) {
+        printf("    note: %d recorded input(s) unused, %d filled in with defaults\n", use.unused, use.defaulted);
+    }
+
+    if (write && !writeTrace(trace, hostDump())) {
+        fprintf(stderr, "%s: write failed\n", trace.path.c_str());
+        return 2;
+    }
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    bool write = false;
+    bool verbose = false;
+    std::vector<Trace> traces;
+    std::map<std::string, int> blocksPerFile;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--write") == 0) {
+            write = true;
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (!parseTraces(argv[i], traces)) {
+            return 2;
+        } else {
+            blocksPerFile[argv[i]] = 0;
+        }
+    }
+    if (blocksPerFile.empty()) {
+        fprintf(stderr, "usage: %s [-v] [--write] <trace file>...\n", argv[0]);
+        return 2;
+    }
+    for (const Trace &trace : traces) blocksPerFile[trace.path]++;
+
+    int replayed = 0;
+    int failed = 0;
+    for (const Trace &trace : traces) {
+        if (!handles(trace)) continue;
+        if (write && blocksPerFile[trace.path] > 1) {
+            fprintf(stderr, "%s: --write needs one #TRACE block per file\n", trace.path.c_str());
+            return 2;
+        }
+
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            int status = replay(trace, write, verbose);
+            fflush(stdout);
+            _exit(status);
+        }
+
+        int status = 0;
+        waitpid(child, &status, 0);
+        replayed++;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            if (!WIFEXITED(status)) {
+                printf("FAIL %s %s (%s:%d): replay crashed\n", trace.sketch.c_str(), trace.scenario.c_str(),
+                       trace.path.c_str(), trace.headerLine);
+            }
+            failed++;
+        }
+    }
+
+    printf("%s build %d: %d scenario(s) replayed, %d failed\n", SKETCH_NAME, SKETCH_BUILD, replayed, failed);
+    return failed > 0 ? 1 : 0;
+}
@@ -1,14 +1,31 @@
 /**
  * ESP32-C3 Firebase Transmission Rate Test
  * Tests 5 different data rates: 2Hz, 1Hz, 0.5Hz, 0.333Hz, 0.25Hz
+ * Sampling runs in its own FreeRTOS task; loop() folds readings into
+ * fixed windows and uploads only the window summaries
+ * WiFi reconnects on events with backoff; loop() never blocks on the radio
+ * Rates and mode duration can be tuned remotely via /config/<device id>
+ * BUILD_RATE flashes a single-rate image instead of cycling all five
  */
 
+// Experiment build: BUILD_ALL_RATES cycles all five rates, 0-4 builds only that rate
+#define BUILD_ALL_RATES -1
+#ifndef BUILD_RATE
+#define BUILD_RATE BUILD_ALL_RATES
+#endif
+
 #define ENABLE_USER_AUTH
 #define ENABLE_DATABASE
 
 #include <WiFi.h>
 #include <WiFiClientSecure.h>
 #include <FirebaseClient.h>
+#include <sys/time.h>
+#include <Preferences.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "wifi-connection.h"
 
 // Pin definitions
 #define TRIG_PIN 2
@@ -40,14 +57,23 @@ enum TransmissionMode {
     MODE_0_25HZ = 4    // Once every 4 seconds
 };
 
+#if BUILD_RATE == BUILD_ALL_RATES
 TransmissionMode currentMode = MODE_2HZ;
+const int RATE_COUNT = 5;
+#else
+// Fixed at compile time, so MODE_NAMES[currentMode] folds to a constant; the interval still
+// comes from config.intervals[], which remote config can change at runtime
+constexpr TransmissionMode currentMode = (TransmissionMode)BUILD_RATE;
+const int RATE_COUNT = 1;
+#endif
+
 unsigned long modeStartTime = 0;
 const unsigned long MODE_DURATION = 60000; // 60 seconds per mode for accurate measurement
 int modeCount = 0;
 int readingCount = 0;
 
 // Transmission intervals (milliseconds)
-const unsigned long INTERVALS[] = {
+constexpr unsigned long INTERVALS[] = {
     500,   // 2 Hz = every 500ms
     1000,  // 1 Hz = every 1000ms
     2000,  // 0.5 Hz = every 2000ms
@@ -55,7 +81,7 @@ const unsigned long INTERVALS[] = {
     4000   // 0.25 Hz = every 4000ms
 };
 
-const char* MODE_NAMES[] = {
+constexpr const char* MODE_NAMES[] = {
     "2 Hz (2x per second)",
     "1 Hz (1x per second)",
     "0.5 Hz (every 2 sec)",
@@ -63,10 +89,150 @@ const char* MODE_NAMES[] = {
     "0.25 Hz (every 4 sec)"
 };
 
+// Remote configuration at /config/<MAC without colons>, cached in NVS
+struct DeviceConfig {
+    int version;
+    unsigned long modeDuration;
+    unsigned long intervals[5];
+};
+
+DeviceConfig config = { 0, MODE_DURATION, { INTERVALS[0], INTERVALS[1], INTERVALS[2], INTERVALS[3], INTERVALS[4] } };
+
+// Wall clock (SNTP runs in the background while WiFi stays up)
+const char* NTP_SERVER = "pool.ntp.org";
+const time_t MIN_VALID_EPOCH = 1700000000; // Anything earlier means "not synced yet"
+
+// Sampling task -> network (loop) hand-off
+struct Reading {
+    double timestamp;   // Wall-clock ms when the echo was taken, 0 before SNTP answers
+    unsigned long uptimeMs; // millis() when the echo was taken
+    float distance;     // -1 if the echo failed
+    uint16_t mode;      // modeCount the reading belongs to
+    uint16_t index;     // Reading number within the mode
+};
+
+const unsigned long QUEUE_SIZE = 64;  // Power of two; 32 s of backlog at 2 Hz
+const UBaseType_t SAMPLING_TASK_PRIORITY = 2; // Above loopTask (1) so uploads can't delay samples
+
+// Lock-free single-producer/single-consumer ring
+Reading readingQueue[QUEUE_SIZE];
+std::atomic<uint32_t> queueHead(0); // Advanced only by the sampling task
+std::atomic<uint32_t> queueTail(0); // Advanced only by loop()
+
+// Sampling control, written by loop() and read by the sampling task
+volatile bool samplingEnabled = false;
+volatile bool samplingBusy = false;
+TaskHandle_t samplingTaskHandle = nullptr; // Parked while sampling is off, woken by startSampling()
+volatile unsigned long sampleInterval = 500;
+volatile int sampleMode = 0;
+
+// Per-mode sampling metrics, written by the sampling task (reset only while it is paused)
+struct SamplingStats {
+    unsigned long samples;
+    unsigned long overruns;     // Readings dropped because the queue was full
+    unsigned long missedSlots;  // Schedule slots skipped because a sample ran late
+    unsigned long highWater;    // Deepest queue depth seen
+    unsigned long maxJitterUs;  // Worst lateness vs. the ideal schedule
+    uint64_t totalJitterUs;
+};
+SamplingStats samplingStats;
+
+// Windowed aggregation: only per-window summaries are uploaded
+const unsigned long WINDOW_MS = 10000;  // Summary window length
+const int HISTOGRAM_BINS = 64;          // p95 sketch resolution (~6 cm per bin)
+const float HISTOGRAM_MIN_CM = 2.0;
+const float HISTOGRAM_MAX_CM = 400.0;
+const float ANOMALY_STDDEV_CM = 20.0;   // Spread that marks a window as anomalous
+const bool UPLOAD_RAW_ON_ANOMALY = true; // Also upload the raw readings of anomalous windows
+const int RAW_CAPACITY = 64;            // Raw readings kept per window for that upload
+const unsigned long MIN_INTERVAL = (WINDOW_MS + RAW_CAPACITY - 1) / RAW_CAPACITY; // 157 ms: a window fits in rawWindow
+
+struct WindowStats {
+    int count;          // Readings in the window, including failed echoes
+    int valid;          // Readings folded into the statistics below
+    float minimum;
+    float maximum;
+    double mean;        // Running mean (Welford)
+    double m2;          // Sum of squared deviations (Welford)
+    uint16_t histogram[HISTOGRAM_BINS];
+    uint16_t mode;
+    uint16_t firstIndex;
+    double startTimestamp;
+    unsigned long startUptimeMs;
+};
+
+WindowStats window;
+Reading rawWindow[RAW_CAPACITY];
+int windowCount = 0; // Windows uploaded in the current mode
+
+// Per-mode trace: compact 8-byte records, dumped over Serial as hex when TRACE_DUMP is set
+// or the mode exceeds its budget; trace-replay/ re-runs the dumped scenarios on the host
+#ifndef TRACE_DUMP
+#define TRACE_DUMP 0
+#endif
+
+enum TraceType : uint8_t {
+    TRACE_STAGE = 1,       // tag = transmission mode entered
+    TRACE_ECHO = 2,        // value = echo pulse width (us), 0 = timeout
+    TRACE_WIFI = 3,        // tag = wl_status_t, value = connect time (ms) once connected
+    TRACE_FB_REQUEST = 4,  // value = readings summarised by the request
+    TRACE_FB_RESPONSE = 5, // tag = 1 ok / 0 error, value = latency (ms)
+    TRACE_END = 6
+};
+
+struct TraceEvent {
+    uint32_t timeMs;
+    uint8_t type;
+    uint8_t tag;
+    uint16_t value;
+};
+
+// Per-rate budget, derived from the live config by rateBudget()
+struct TraceBudget {
+    unsigned long awakeMs;
+    int requests;
+    unsigned long microAh;
+};
+
+const int TRACE_CAPACITY = 512;
+const float WIFI_MA = 100.0;          // Connected, idle radio
+const float FIREBASE_EXTRA_MA = 80.0; // On top of WIFI_MA while a request is in flight
+const unsigned long MODELLED_REQUEST_MS = 1000; // Firebase round trip assumed by the budget
+const float BUDGET_HEADROOM = 1.1;
+const unsigned long FLUSH_TIMEOUT = 2000; // Max time spent flushing at the end of a mode
+
+TraceEvent traceBuffer[TRACE_CAPACITY];
+std::atomic<int> traceCount(0); // Shared by loop() and the sampling task
+int pendingRequests = 0;
+unsigned long requestStart[8];
+
 // Function declarations
 void processData(AsyncResult &aResult);
 float readUltrasonic();
-void setupWiFi();
+double timestampMs();
+void appendTimestamp(String &json, double timestamp, unsigned long uptimeMs);
+void samplingTask(void *param);
+bool queuePush(const Reading &reading);
+bool queuePop(Reading &reading);
+void startSampling();
+void stopSampling();
+void processReadings(bool flush);
+void resetWindow();
+void foldReading(const Reading &reading);
+float windowP95();
+void uploadWindow();
+void printSamplingStats();
+void traceEvent(uint8_t type, uint8_t tag, uint16_t value);
+void traceWiFiStatus();
+bool checkModeBudget();
+TraceBudget rateBudget(int rate);
+void traceResponse(bool ok);
+void loadConfig();
+bool checkRemoteConfig();
+bool jsonNumber(const String &json, const char *key, double &value);
+String deviceId();
+void dumpTrace();
+void printFootprint();
 
 void setup()
 {
@@ -80,16 +246,28 @@ void setup()
     Serial.println("\n========================================");
     Serial.println("  FIREBASE TRANSMISSION RATE TEST");
     Serial.println("========================================");
+    printFootprint();
+    
+    loadConfig();
     
-    // Connect WiFi
-    setupWiFi();
+    // Connect WiFi; setup() is the only place that waits for it
+    WiFi.onEvent(onWiFiEvent);
+    startWiFi(ssid, password);
+    unsigned long wifiWaitStart = millis();
+    while (wifiState != WIFI_STATE_CONNECTED && millis() - wifiWaitStart < 30000) {
+        serviceWiFi();
+        delay(50);
+    }
     
-    if (WiFi.status() != WL_CONNECTED) {
+    if (wifiState != WIFI_STATE_CONNECTED) {
         Serial.println("ERROR: WiFi not connected!");
         Serial.println("Cannot proceed with test.");
         while(1) delay(1000);
     }
     
+    // Start SNTP on the existing connection; uploads carry uptime_ms until it answers
+    configTime(0, 0, NTP_SERVER);
+    
     // Initialize Firebase
     Serial.println("\nInitializing Firebase...");
     ssl_client.setInsecure();
@@ -116,23 +294,33 @@ void setup()
     }
     
     Serial.println("✓ Firebase Ready!");
+    checkRemoteConfig();
     Serial.println("\n========================================");
     Serial.println("Starting Test Sequence");
-    Serial.println("Each mode runs for 60 seconds");
+    Serial.printf("Each mode runs for %lu seconds\n", config.modeDuration / 1000);
     Serial.println("========================================\n");
     
     delay(2000);
     
+    xTaskCreate(samplingTask, "sampling", 4096, nullptr, SAMPLING_TASK_PRIORITY, &samplingTaskHandle);
+    
     // Start first mode
     modeCount = 1;
     readingCount = 0;
+    windowCount = 0;
+    resetWindow();
+#if BUILD_RATE == BUILD_ALL_RATES
     currentMode = MODE_2HZ;
+#endif
     modeStartTime = millis();
+    traceCount = 0;
+    traceEvent(TRACE_STAGE, currentMode, 0);
+    startSampling();
     
     Serial.println("┌────────────────────────────────────────┐");
     Serial.printf("│ MODE %d: %s           │\n", modeCount, MODE_NAMES[currentMode]);
-    Serial.println("│ Duration: 60 seconds                   │");
-    Serial.printf("│ Interval: %lu ms                      │\n", INTERVALS[currentMode]);
+    Serial.printf("│ Duration: %lu seconds                   │\n", config.modeDuration / 1000);
+    Serial.printf("│ Interval: %lu ms                      │\n", config.intervals[currentMode]);
     Serial.println("└────────────────────────────────────────┘");
     Serial.println("\n⏱️  Recording power consumption...\n");
 }
@@ -140,19 +328,38 @@ void setup()
 void loop()
 {
     unsigned long currentTime = millis();
+    serviceWiFi();
     app.loop();
+    traceWiFiStatus();
     
     // Check if mode duration completed
-    if (currentTime - modeStartTime >= MODE_DURATION) {
+    if (currentTime - modeStartTime >= config.modeDuration) {
+        // Stop sampling and flush what is still queued
+        stopSampling();
+        unsigned long flushStart = millis();
+        while ((queueHead.load() != queueTail.load() || window.count > 0 || pendingRequests > 0) && 
+               app.ready() && millis() - flushStart < FLUSH_TIMEOUT) {
+            processReadings(true);
+            app.loop();
+        }
+        traceEvent(TRACE_END, 0, 0);
+        
         Serial.println("\n========================================");
         Serial.printf("MODE %d COMPLETE: %s\n", modeCount, MODE_NAMES[currentMode]);
-        Serial.printf("Total readings sent: %d\n", readingCount);
+        Serial.printf("Total readings sent: %d (in %d window summaries)\n", readingCount, windowCount);
+        printSamplingStats();
+        printConnectStats();
+        bool withinBudget = checkModeBudget();
+        if (TRACE_DUMP || !withinBudget) dumpTrace();
         Serial.println("========================================\n");
         
+        // New settings take effect from the next mode
+        checkRemoteConfig();
+        
         // Check Power Profiler now
         Serial.println("📊 CHECK POWER PROFILER NOW!");
         Serial.println("   - Note the AVERAGE current (mA)");
-        Serial.println("   - Zoom to the last 60 seconds");
+        Serial.printf("   - Zoom to the last %lu seconds\n", config.modeDuration / 1000);
         Serial.println("   - Write down the value\n");
         
         // Wait before next mode
@@ -160,19 +367,20 @@ void loop()
         delay(10000);
         
         // Move to next mode
+#if BUILD_RATE == BUILD_ALL_RATES
         currentMode = (TransmissionMode)((currentMode + 1) % 5);
+#endif
         
         // Check if completed all modes
-        if (currentMode == MODE_2HZ && modeCount >= 5) {
+        if (modeCount >= RATE_COUNT) {
             Serial.println("\n========================================");
             Serial.println("  ALL TESTS COMPLETED!");
             Serial.println("========================================\n");
             Serial.println("Summary of data to record:");
-            Serial.println("1. MODE 1 (2 Hz): ___ mA");
-            Serial.println("2. MODE 2 (1 Hz): ___ mA");
-            Serial.println("3. MODE 3 (0.5 Hz): ___ mA");
-            Serial.println("4. MODE 4 (0.333 Hz): ___ mA");
-            Serial.println("5. MODE 5 (0.25 Hz): ___ mA");
+            for (int i = 0; i < RATE_COUNT; i++) {
+                int rate = RATE_COUNT == 1 ? (int)currentMode : i;
+                Serial.printf("%d. MODE %d (%s): ___ mA\n", i + 1, i + 1, MODE_NAMES[rate]);
+            }
             Serial.println("\nTest will restart in 30 seconds...\n");
             delay(30000);
             modeCount = 0;
@@ -181,41 +389,254 @@ void loop()
         // Start next mode
         modeCount++;
         readingCount = 0;
-        modeStartTime = currentTime;
+        windowCount = 0;
+        resetWindow();
+        traceCount = 0;
+        modeStartTime = millis();
+        traceEvent(TRACE_STAGE, currentMode, 0);
+        startSampling();
         
         Serial.println("┌────────────────────────────────────────┐");
         Serial.printf("│ MODE %d: %s           │\n", modeCount, MODE_NAMES[currentMode]);
-        Serial.println("│ Duration: 60 seconds                   │");
-        Serial.printf("│ Interval: %lu ms                      │\n", INTERVALS[currentMode]);
+        Serial.printf("│ Duration: %lu seconds                   │\n", config.modeDuration / 1000);
+        Serial.printf("│ Interval: %lu ms                      │\n", config.intervals[currentMode]);
         Serial.println("└────────────────────────────────────────┘");
         Serial.println("\n⏱️  Recording power consumption...\n");
     }
     
-    // Send data at appropriate interval
-    static unsigned long lastSend = 0;
-    if (currentTime - lastSend >= INTERVALS[currentMode]) {
-        lastSend = currentTime;
-        readingCount++;
+    // Fold readings queued by the sampling task into the current window
+    processReadings(false);
+    
+    delay(10); // Small delay to prevent watchdog issues
+}
+
+void samplingTask(void *param)
+{
+    int64_t dueUs = 0;
+    bool running = false;
+    
+    for (;;) {
+        if (!samplingEnabled) {
+            // Sleep until startSampling() notifies us; no wake-ups while the other modes are measured
+            running = false;
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        if (!running) {
+            dueUs = esp_timer_get_time();
+            running = true;
+        }
+        
+        int64_t waitUs = dueUs - esp_timer_get_time();
+        if (waitUs >= 1000) {
+            vTaskDelay(pdMS_TO_TICKS(waitUs / 1000));
+            continue;
+        }
+        
+        samplingBusy = true;
+        if (!samplingEnabled) {
+            samplingBusy = false;
+            continue;
+        }
+        
+        int64_t startUs = esp_timer_get_time();
+        unsigned long jitterUs = startUs > dueUs ? (unsigned long)(startUs - dueUs) : 0;
         
-        // Read sensor
         float distance = readUltrasonic();
-        if (distance < 0) distance = 100.0;
         
-        // Send to Firebase
-        String path = "/power_test/mode_" + String(modeCount) + 
-                     "/reading_" + String(readingCount);
+        Reading reading;
+        reading.timestamp = timestampMs();
+        reading.uptimeMs = millis();
+        reading.distance = distance;
+        reading.mode = sampleMode;
+        reading.index = ++samplingStats.samples;
+        
+        if (!queuePush(reading)) samplingStats.overruns++;
         
-        Database.set<float>(async_client, path + "/distance", distance, processData, "Send");
-        Database.set<unsigned long>(async_client, path + "/timestamp", millis(), processData, "Send");
+        unsigned long depth = queueHead.load() - queueTail.load();
+        if (depth > samplingStats.highWater) samplingStats.highWater = depth;
+        if (jitterUs > samplingStats.maxJitterUs) samplingStats.maxJitterUs = jitterUs;
+        samplingStats.totalJitterUs += jitterUs;
         
-        // Print progress
-        Serial.printf("[%02lu:%02lu] Reading #%d: %.2f cm → Firebase\n", 
-                     (currentTime - modeStartTime) / 60000,
-                     ((currentTime - modeStartTime) / 1000) % 60,
-                     readingCount, distance);
+        samplingBusy = false;
+        
+        // Next slot on the ideal grid, skipping any we already missed
+        int64_t intervalUs = sampleInterval * 1000LL;
+        dueUs += intervalUs;
+        while (dueUs <= esp_timer_get_time()) {
+            dueUs += intervalUs;
+            samplingStats.missedSlots++;
+        }
     }
+}
+
+bool queuePush(const Reading &reading)
+{
+    uint32_t head = queueHead.load(std::memory_order_relaxed);
+    if (head - queueTail.load(std::memory_order_acquire) >= QUEUE_SIZE) return false;
     
-    delay(10); // Small delay to prevent watchdog issues
+    readingQueue[head % QUEUE_SIZE] = reading;
+    queueHead.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool queuePop(Reading &reading)
+{
+    uint32_t tail = queueTail.load(std::memory_order_relaxed);
+    if (tail == queueHead.load(std::memory_order_acquire)) return false;
+    
+    reading = readingQueue[tail % QUEUE_SIZE];
+    queueTail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+void startSampling()
+{
+    memset(&samplingStats, 0, sizeof(samplingStats));
+    sampleInterval = config.intervals[currentMode];
+    sampleMode = modeCount;
+    samplingEnabled = true;
+    xTaskNotifyGive(samplingTaskHandle);
+}
+
+void stopSampling()
+{
+    samplingEnabled = false;
+    while (samplingBusy) delay(1);
+}
+
+void processReadings(bool flush)
+{
+    // A full window waits (and readings back up in the ring) until Firebase can take it
+    unsigned long windowSize = max(1UL, WINDOW_MS / sampleInterval);
+    Reading reading;
+    while ((unsigned long)window.count < windowSize && queuePop(reading)) {
+        foldReading(reading);
+    }
+    
+    bool windowDone = (unsigned long)window.count >= windowSize || 
+                      (flush && window.count > 0 && queueHead.load() == queueTail.load());
+    if (windowDone && app.ready()) {
+        uploadWindow();
+    }
+}
+
+void resetWindow()
+{
+    memset(&window, 0, sizeof(window));
+}
+
+void foldReading(const Reading &reading)
+{
+    if (window.count == 0) {
+        window.mode = reading.mode;
+        window.firstIndex = reading.index;
+        window.startTimestamp = reading.timestamp;
+        window.startUptimeMs = reading.uptimeMs;
+    }
+    window.count++;
+    
+    // Failed echoes only count towards the window; they stay out of the statistics
+    if (reading.distance < 0) return;
+    
+    if (window.valid < RAW_CAPACITY) rawWindow[window.valid] = reading;
+    if (window.valid == 0) {
+        window.minimum = reading.distance;
+        window.maximum = reading.distance;
+    }
+    window.valid++;
+    window.minimum = min(window.minimum, reading.distance);
+    window.maximum = max(window.maximum, reading.distance);
+    
+    double delta = reading.distance - window.mean;
+    window.mean += delta / window.valid;
+    window.m2 += delta * (reading.distance - window.mean);
+    
+    float binWidth = (HISTOGRAM_MAX_CM - HISTOGRAM_MIN_CM) / HISTOGRAM_BINS;
+    int bin = constrain((int)((reading.distance - HISTOGRAM_MIN_CM) / binWidth), 0, HISTOGRAM_BINS - 1);
+    window.histogram[bin]++;
+}
+
+float windowP95()
+{
+    if (window.valid == 0) return 0;
+    
+    // Walk the histogram to the 95th-percentile rank and interpolate inside that bin
+    int rank = (window.valid * 95 + 99) / 100;
+    float binWidth = (HISTOGRAM_MAX_CM - HISTOGRAM_MIN_CM) / HISTOGRAM_BINS;
+    int seen = 0;
+    for (int bin = 0; bin < HISTOGRAM_BINS; bin++) {
+        if (seen + window.histogram[bin] >= rank) {
+            float fraction = (float)(rank - seen) / window.histogram[bin];
+            float value = HISTOGRAM_MIN_CM + (bin + fraction) * binWidth;
+            return constrain(value, window.minimum, window.maximum);
+        }
+        seen += window.histogram[bin];
+    }
+    return window.maximum;
+}
+
+void uploadWindow()
+{
+    float stddev = window.valid > 1 ? sqrt(window.m2 / (window.valid - 1)) : 0;
+    bool anomalous = stddev > ANOMALY_STDDEV_CM;
+    int invalid = window.count - window.valid;
+    
+    String json = "{";
+    char entry[224];
+    if (window.valid > 0) {
+        snprintf(entry, sizeof(entry), 
+            "\"mode_%u/window_%d\":{\"count\":%d,\"invalid\":%d,\"min\":%.2f,\"max\":%.2f,\"mean\":%.2f,"
+            "\"stddev\":%.2f,\"p95\":%.2f,\"first_reading\":%u,\"anomalous\":%s",
+            window.mode, windowCount + 1, window.valid, invalid, window.minimum, window.maximum, window.mean, 
+            stddev, windowP95(), window.firstIndex, anomalous ? "true" : "false");
+    } else {
+        // Nothing but failed echoes: no statistics to report
+        snprintf(entry, sizeof(entry), 
+            "\"mode_%u/window_%d\":{\"count\":0,\"invalid\":%d,\"first_reading\":%u",
+            window.mode, windowCount + 1, invalid, window.firstIndex);
+    }
+    json += entry;
+    appendTimestamp(json, window.startTimestamp, window.startUptimeMs);
+    json += "}";
+    
+    // Raw readings only go up when the summary hides something interesting
+    if (anomalous && UPLOAD_RAW_ON_ANOMALY) {
+        int rawCount = min(window.valid, RAW_CAPACITY);
+        for (int i = 0; i < rawCount; i++) {
+            snprintf(entry, sizeof(entry), ",\"mode_%u/reading_%u\":{\"distance\":%.2f",
+                     rawWindow[i].mode, rawWindow[i].index, rawWindow[i].distance);
+            json += entry;
+            appendTimestamp(json, rawWindow[i].timestamp, rawWindow[i].uptimeMs);
+            json += "}";
+        }
+    }
+    json += "}";
+    
+    traceEvent(TRACE_FB_REQUEST, 0, window.count);
+    Database.update<object_t>(async_client, "/power_test", object_t(json), processData, "Window");
+    readingCount += window.count;
+    windowCount++;
+    
+    unsigned long elapsed = millis() - modeStartTime;
+    Serial.printf("[%02lu:%02lu] Window %d: %d readings (%d invalid), mean %.2f, p95 %.2f, σ %.2f cm%s → Firebase\n", 
+                 elapsed / 60000, (elapsed / 1000) % 60, windowCount, window.valid, invalid, 
+                 window.mean, windowP95(), stddev, anomalous ? " ⚠️ +raw" : "");
+    
+    resetWindow();
+}
+
+void printSamplingStats()
+{
+    unsigned long expected = config.modeDuration / sampleInterval;
+    unsigned long avgJitter = samplingStats.samples > 0 ? 
+        (unsigned long)(samplingStats.totalJitterUs / samplingStats.samples) : 0;
+    
+    Serial.printf("Samples taken: %lu (expected %lu)\n", samplingStats.samples, expected);
+    Serial.printf("Jitter: avg %lu us, max %lu us\n", avgJitter, samplingStats.maxJitterUs);
+    Serial.printf("Queue high-water: %lu / %lu\n", samplingStats.highWater, QUEUE_SIZE);
+    Serial.printf("Overruns: %lu dropped, %lu slots missed\n", 
+                  samplingStats.overruns, samplingStats.missedSlots);
 }
 
 float readUltrasonic()
@@ -227,6 +648,7 @@ float readUltrasonic()
     digitalWrite(TRIG_PIN, LOW);
     
     long duration = pulseIn(ECHO_PIN, HIGH, 50000);
+    traceEvent(TRACE_ECHO, 0, duration);
     if (duration == 0) return -1;
     
     float distance = (float)duration * 0.0343 / 2.0;
@@ -235,44 +657,229 @@ float readUltrasonic()
     return distance;
 }
 
-void setupWiFi()
+double timestampMs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    if (tv.tv_sec < MIN_VALID_EPOCH) return 0; // Not synced yet
+    return (double)tv.tv_sec * 1000.0 + tv.tv_usec / 1000;
+}
+
+void appendTimestamp(String &json, double timestamp, unsigned long uptimeMs)
+{
+    // Wall-clock ms when known; otherwise only ms since boot, under its own key
+    char entry[32];
+    if (timestamp > 0) {
+        snprintf(entry, sizeof(entry), ",\"timestamp\":%.0f", timestamp);
+    } else {
+        snprintf(entry, sizeof(entry), ",\"uptime_ms\":%lu", uptimeMs);
+    }
+    json += entry;
+}
+
+void processData(AsyncResult &aResult)
 {
-    if (WiFi.status() == WL_CONNECTED) return;
+    if (!aResult.isResult()) return;
+    
+    if (aResult.uid() != "authTask" && (aResult.isError() || aResult.available())) {
+        traceResponse(!aResult.isError());
+    }
+    
+    if (aResult.isError()) {
+        Serial.printf("   ✗ Firebase Error: %s\n", aResult.error().message().c_str());
+    }
+}
 
-    Serial.printf("📡 Connecting to %s...\n", ssid);
+void traceEvent(uint8_t type, uint8_t tag, uint16_t value)
+{
+    if (type == TRACE_FB_REQUEST && pendingRequests < 8) {
+        requestStart[pendingRequests++] = millis();
+    }
     
-    WiFi.disconnect(true);
-    WiFi.mode(WIFI_OFF);
-    delay(500);
+    int index = traceCount.fetch_add(1);
+    if (index >= TRACE_CAPACITY) return;
     
-    WiFi.mode(WIFI_STA);
-    WiFi.setSleep(false);
-    WiFi.begin(ssid, password);
+    TraceEvent &event = traceBuffer[index];
+    event.timeMs = millis();
+    event.type = type;
+    event.tag = tag;
+    event.value = value;
+}
 
-    int attempts = 0;
-    Serial.print("   ");
-    while (WiFi.status() != WL_CONNECTED && attempts < 60) {
-        delay(500);
-        Serial.print(".");
-        attempts++;
+void traceWiFiStatus()
+{
+    static wl_status_t lastStatus = WL_IDLE_STATUS;
+    wl_status_t status = WiFi.status();
+    if (status != lastStatus) {
+        lastStatus = status;
+        traceEvent(TRACE_WIFI, status, status == WL_CONNECTED ? min(connectStats.lastMs, 65535UL) : 0);
     }
+}
 
-    Serial.println();
+bool checkModeBudget()
+{
+    unsigned long awakeMs = 0;
+    int requests = 0;
+    float microAh = 0;
     
-    if (WiFi.status() == WL_CONNECTED) {
-        Serial.println("✓ WiFi Connected!");
-        Serial.printf("   IP: %s\n", WiFi.localIP().toString().c_str());
-        Serial.printf("   Signal: %d dBm\n", WiFi.RSSI());
-    } else {
-        Serial.println("✗ WiFi Failed!");
+    int count = min(traceCount.load(), TRACE_CAPACITY);
+    for (int i = 0; i < count; i++) {
+        const TraceEvent &event = traceBuffer[i];
+        if (event.type == TRACE_END) {
+            awakeMs = event.timeMs - traceBuffer[0].timeMs;
+        } else if (event.type == TRACE_FB_REQUEST) {
+            requests++;
+        } else if (event.type == TRACE_FB_RESPONSE) {
+            microAh += event.value * FIREBASE_EXTRA_MA / 3600.0; // mA x ms -> uAh
+        }
     }
+    microAh += awakeMs * WIFI_MA / 3600.0;
+    
+    TraceBudget budget = rateBudget(currentMode);
+    bool withinBudget = awakeMs <= budget.awakeMs && requests <= budget.requests && 
+                        microAh <= budget.microAh;
+    
+    Serial.printf("Budget: awake %lu/%lu ms, requests %d/%d, %.1f/%lu uAh\n", 
+                  awakeMs, budget.awakeMs, requests, budget.requests, microAh, budget.microAh);
+    if (traceCount.load() > TRACE_CAPACITY) {
+        Serial.printf("  (trace truncated: %d events dropped)\n", traceCount.load() - TRACE_CAPACITY);
+    }
+    Serial.println(withinBudget ? "✓ Within budget" : "✗ BUDGET EXCEEDED");
+    return withinBudget;
 }
 
-void processData(AsyncResult &aResult)
+TraceBudget rateBudget(int rate)
 {
-    if (!aResult.isResult()) return;
+    // One request per window: at most duration / interval + 1 samples, windowSize per request
+    unsigned long interval = config.intervals[rate];
+    unsigned long samples = config.modeDuration / interval + 1;
+    unsigned long windowSize = max(1UL, WINDOW_MS / interval);
     
-    if (aResult.isError()) {
-        Serial.printf("   ✗ Firebase Error: %s\n", aResult.error().message().c_str());
+    TraceBudget budget;
+    budget.awakeMs = config.modeDuration + FLUSH_TIMEOUT;
+    budget.requests = (samples + windowSize - 1) / windowSize;
+    budget.microAh = (config.modeDuration * WIFI_MA + 
+                      budget.requests * MODELLED_REQUEST_MS * FIREBASE_EXTRA_MA) / 3600.0 * BUDGET_HEADROOM;
+    return budget;
+}
+
+void dumpTrace()
+{
+    // "#TRACE v1 <sketch> <scenario> <events> [key=value...]" then 8-byte records as hex, 8 per line;
+    // the config rides along so the host replays the mode with the same settings
+    int count = min(traceCount.load(), TRACE_CAPACITY);
+    Serial.printf("#TRACE v1 transpassingrate rate_%d %d duration=%lu interval=%lu build=%d\n", 
+                  (int)currentMode, count, config.modeDuration, config.intervals[currentMode], BUILD_RATE);
+    const uint8_t *bytes = (const uint8_t *)traceBuffer;
+    for (int i = 0; i < count * (int)sizeof(TraceEvent); i++) {
+        Serial.printf("%02x", bytes[i]);
+        if (i % 64 == 63) Serial.println();
+    }
+    Serial.println("\n#END");
+}
+
+void traceResponse(bool ok)
+{
+    // Responses arrive in request order on the single async client
+    if (pendingRequests == 0) return;
+    
+    unsigned long latency = millis() - requestStart[0];
+    for (int i = 1; i < pendingRequests; i++) requestStart[i - 1] = requestStart[i];
+    pendingRequests--;
+    traceEvent(TRACE_FB_RESPONSE, ok ? 1 : 0, min(latency, 65535UL));
+}
+
+void loadConfig()
+{
+    Preferences prefs;
+    prefs.begin("config", true);
+    if (prefs.getBytesLength("device") == sizeof(config)) {
+        prefs.getBytes("device", &config, sizeof(config));
+    }
+    prefs.end();
+    
+    // Older firmware cached intervals down to 100 ms
+    for (int i = 0; i < 5; i++) config.intervals[i] = max(config.intervals[i], MIN_INTERVAL);
+    
+    Serial.printf("Config: v%d (mode %lu ms, intervals %lu/%lu/%lu/%lu/%lu ms)\n", 
+                  config.version, config.modeDuration, config.intervals[0], config.intervals[1], 
+                  config.intervals[2], config.intervals[3], config.intervals[4]);
+}
+
+bool checkRemoteConfig()
+{
+    if (!app.ready()) return false;
+    String path = "/config/" + deviceId();
+    
+    traceEvent(TRACE_FB_REQUEST, 0, 0);
+    int version = Database.get<int>(async_client, path + "/version");
+    bool ok = async_client.lastError().code() == 0;
+    traceResponse(ok);
+    if (!ok || version == config.version) return false;
+    
+    traceEvent(TRACE_FB_REQUEST, 0, 0);
+    String json = Database.get<String>(async_client, path);
+    ok = async_client.lastError().code() == 0;
+    traceResponse(ok);
+    if (!ok) {
+        Serial.println("✗ Config fetch failed, keeping cached config");
+        return false;
+    }
+    
+    // Missing keys keep their current value; out-of-range values are clamped before the cast
+    DeviceConfig updated = config;
+    updated.version = version;
+    double value;
+    if (jsonNumber(json, "mode_duration", value)) {
+        updated.modeDuration = (unsigned long)constrain(value, 5000.0, 3600000.0);
+    }
+    char key[16];
+    for (int i = 0; i < 5; i++) {
+        snprintf(key, sizeof(key), "interval_%d", i);
+        if (jsonNumber(json, key, value)) {
+            updated.intervals[i] = (unsigned long)constrain(value, (double)MIN_INTERVAL, 600000.0);
+        }
+    }
+    config = updated;
+    
+    Preferences prefs;
+    prefs.begin("config", false);
+    prefs.putBytes("device", &config, sizeof(config));
+    prefs.end();
+    
+    Serial.printf("✓ Config v%d applied (mode %lu ms, intervals %lu/%lu/%lu/%lu/%lu ms)\n", 
+                  config.version, config.modeDuration, config.intervals[0], config.intervals[1], 
+                  config.intervals[2], config.intervals[3], config.intervals[4]);
+    return true;
+}
+
+bool jsonNumber(const String &json, const char *key, double &value)
+{
+    String needle = String("\"") + key + "\":";
+    int start = json.indexOf(needle);
+    if (start < 0) return false;
+    
+    value = atof(json.c_str() + start + needle.length());
+    return isfinite(value); // nan/inf would survive the clamp
+}
+
+String deviceId()
+{
+    String mac = WiFi.macAddress();
+    mac.replace(":", "");
+    return mac;
+}
+
+void printFootprint()
+{
+    // Heap size is what static data leaves over after the linked stacks
+    if (RATE_COUNT == 1) {
+        Serial.printf("Build: %s only\n", MODE_NAMES[currentMode]);
+    } else {
+        Serial.println("Build: all rates");
     }
+    Serial.printf("Flash: %lu bytes (%lu free)\n", 
+                  (unsigned long)ESP.getSketchSize(), (unsigned long)ESP.getFreeSketchSpace());
+    Serial.printf("Heap:  %lu free of %lu bytes\n", 
+                  (unsigned long)ESP.getFreeHeap(), (unsigned long)ESP.getHeapSize());
 }
@@ -0,0 +1,158 @@
+/**
+ * Event-driven WiFi connection shared by the bench sketches
+ * (1-minute-5-stage-code.cpp, transpassingrate.cpp)
+ * - startWiFi() kicks off a connect and returns; loop() never waits on the radio
+ * - serviceWiFi() runs from loop(): picks up GOT_IP / link-loss events, retries
+ *   failed attempts with exponential backoff, soft-reconnects a lost link
+ * - Connect latency (begin()/reconnect() to GOT_IP) is tracked in connectStats
+ * 
+ * Definitions live here, so include it from exactly one .cpp per sketch.
+ */
+
+#pragma once
+
+#include <WiFi.h>
+
+enum WiFiState {
+    WIFI_STATE_OFF,
+    WIFI_STATE_CONNECTING,
+    WIFI_STATE_CONNECTED,
+    WIFI_STATE_BACKOFF
+};
+
+const unsigned long WIFI_ATTEMPT_TIMEOUT = 10000; // Give up on one attempt after 10 s
+const unsigned long WIFI_BACKOFF_MIN = 500;       // First retry delay; doubles per failure
+const unsigned long WIFI_BACKOFF_MAX = 16000;
+
+WiFiState wifiState = WIFI_STATE_OFF;
+bool wifiRadioOn = false;          // STA already configured; retries skip the mode cycle
+unsigned long wifiAttemptStart = 0;
+unsigned long wifiRetryAt = 0;
+unsigned long wifiBackoff = WIFI_BACKOFF_MIN;
+
+// Set by the WiFi event task, consumed by serviceWiFi()
+volatile bool wifiGotIp = false;
+volatile bool wifiLinkLost = false;
+
+// Connect latency, measured from begin()/reconnect() to GOT_IP
+struct ConnectStats {
+    unsigned long connects;
+    unsigned long failures;
+    unsigned long totalMs;
+    unsigned long minMs;
+    unsigned long maxMs;
+    unsigned long lastMs;
+};
+ConnectStats connectStats;
+
+void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info)
+{
+    // Runs in the WiFi event task; just flag it for serviceWiFi()
+    if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+        wifiGotIp = true;
+    } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
+        // reconnect() drops the old association first; that one is ours, not a lost link
+        if (info.wifi_sta_disconnected.reason != WIFI_REASON_ASSOC_LEAVE) wifiLinkLost = true;
+    }
+}
+
+void startWiFi(const char *ssid, const char *password)
+{
+    if (wifiState != WIFI_STATE_OFF) return;
+    
+    Serial.printf("📡 Connecting to %s (MAC: %s)...\n", ssid, WiFi.macAddress().c_str());
+    
+    if (!wifiRadioOn) {
+        WiFi.mode(WIFI_STA);
+        WiFi.setSleep(false);          // Disable power saving
+        WiFi.setAutoReconnect(false);  // Retries are paced by serviceWiFi()
+        wifiRadioOn = true;
+    }
+    
+    wifiGotIp = false;
+    wifiLinkLost = false;
+    wifiBackoff = WIFI_BACKOFF_MIN;
+    WiFi.begin(ssid, password);
+    wifiState = WIFI_STATE_CONNECTING;
+    wifiAttemptStart = millis();
+}
+
+void serviceWiFi()
+{
+    if (wifiState == WIFI_STATE_OFF) return;
+    unsigned long now = millis();
+    
+    if (wifiGotIp) {
+        wifiGotIp = false;
+        if (wifiState == WIFI_STATE_CONNECTING) {
+            unsigned long latency = now - wifiAttemptStart;
+            if (connectStats.connects == 0 || latency < connectStats.minMs) connectStats.minMs = latency;
+            if (latency > connectStats.maxMs) connectStats.maxMs = latency;
+            connectStats.totalMs += latency;
+            connectStats.lastMs = latency;
+            connectStats.connects++;
+            Serial.printf("✓ WiFi Connected in %lu ms - IP: %s, Signal: %d dBm\n", 
+                latency, WiFi.localIP().toString().c_str(), WiFi.RSSI());
+        }
+        wifiState = WIFI_STATE_CONNECTED;
+        wifiBackoff = WIFI_BACKOFF_MIN;
+    }
+    
+    bool attemptFailed = false;
+    if (wifiLinkLost) {
+        wifiLinkLost = false;
+        if (wifiState == WIFI_STATE_CONNECTED) {
+            // Soft reconnect: the radio stays in STA mode, no disconnect/WIFI_OFF cycle
+            Serial.println("⚠️  WiFi lost, reconnecting...");
+            WiFi.reconnect();
+            wifiState = WIFI_STATE_CONNECTING;
+            wifiAttemptStart = now;
+        } else if (wifiState == WIFI_STATE_CONNECTING) {
+            attemptFailed = true; // Auth failure, AP not found, ...
+        }
+    }
+    
+    if (wifiState == WIFI_STATE_CONNECTING && now - wifiAttemptStart >= WIFI_ATTEMPT_TIMEOUT) {
+        attemptFailed = true;
+    }
+    
+    if (attemptFailed) {
+        connectStats.failures++;
+        Serial.printf("✗ WiFi attempt failed (Status: %d), retrying in %lu ms\n", 
+            WiFi.status(), wifiBackoff);
+        wifiState = WIFI_STATE_BACKOFF;
+        wifiRetryAt = now + wifiBackoff;
+        wifiBackoff = min(wifiBackoff * 2, WIFI_BACKOFF_MAX);
+    }
+    
+    if (wifiState == WIFI_STATE_BACKOFF && (long)(now - wifiRetryAt) >= 0) {
+        wifiLinkLost = false; // Anything still queued belongs to the failed attempt
+        WiFi.reconnect();
+        wifiState = WIFI_STATE_CONNECTING;
+        wifiAttemptStart = now;
+    }
+}
+
+void disconnectWiFi()
+{
+    if (wifiRadioOn) {
+        WiFi.disconnect(true);
+        WiFi.mode(WIFI_OFF);
+        wifiRadioOn = false;
+        Serial.println("WiFi disconnected");
+    }
+    wifiState = WIFI_STATE_OFF;
+}
+
+void printConnectStats()
+{
+    Serial.println("\nWIFI CONNECT:");
+    if (connectStats.connects == 0) {
+        Serial.printf("  Connects:   0 (%lu failed attempts)\n", connectStats.failures);
+        return;
+    }
+    Serial.printf("  Connects:   %lu (%lu failed attempts)\n", 
+                  connectStats.connects, connectStats.failures);
+    Serial.printf("  Latency:    min %lu ms, avg %lu ms, max %lu ms\n", 
+                  connectStats.minMs, connectStats.totalMs / connectStats.connects, connectStats.maxMs);
+}